@@ -0,0 +1,110 @@
+﻿#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace hexagonal_walk {
+  // タイルの集合を、Widthビットのビット列で表現します。64ビット単位の単純なループにしておけば、-march=nativeでコンパイラがSIMD命令に変換してくれます。
+  template <std::size_t Width>
+  class bitboard {
+    static_assert(Width % 64 == 0, "Width should be a multiple of 64.");
+
+    std::array<std::uint64_t, Width / 64> _words;
+
+  public:
+    static constexpr std::size_t width = Width;
+
+    bitboard() noexcept
+      : _words()
+    {
+      ;
+    }
+
+    const auto test(const std::size_t& index) const noexcept {
+      return static_cast<bool>((_words[index / 64] >> (index % 64)) & 1);
+    }
+
+    void set(const std::size_t& index) noexcept {
+      _words[index / 64] |= static_cast<std::uint64_t>(1) << (index % 64);
+    }
+
+    void reset(const std::size_t& index) noexcept {
+      _words[index / 64] &= ~(static_cast<std::uint64_t>(1) << (index % 64));
+    }
+
+    const auto any() const noexcept {
+      std::uint64_t result = 0;
+
+      for (const auto& word : _words) {
+        result |= word;
+      }
+
+      return result != 0;
+    }
+
+    const auto count() const noexcept {
+      auto result = 0;
+
+      for (const auto& word : _words) {
+        result += __builtin_popcountll(word);
+      }
+
+      return result;
+    }
+
+    auto& operator|=(const bitboard& other) noexcept {
+      for (auto i = static_cast<std::size_t>(0); i < _words.size(); ++i) {
+        _words[i] |= other._words[i];
+      }
+
+      return *this;
+    }
+
+    auto& operator&=(const bitboard& other) noexcept {
+      for (auto i = static_cast<std::size_t>(0); i < _words.size(); ++i) {
+        _words[i] &= other._words[i];
+      }
+
+      return *this;
+    }
+
+    // otherに含まれるビットを落とします。~を作ってから&するより、一時オブジェクトが減ります。
+    auto& subtract(const bitboard& other) noexcept {
+      for (auto i = static_cast<std::size_t>(0); i < _words.size(); ++i) {
+        _words[i] &= ~other._words[i];
+      }
+
+      return *this;
+    }
+
+    const auto operator|(const bitboard& other) const noexcept {
+      return bitboard(*this) |= other;
+    }
+
+    const auto operator&(const bitboard& other) const noexcept {
+      return bitboard(*this) &= other;
+    }
+
+    const auto operator==(const bitboard& other) const noexcept {
+      return _words == other._words;
+    }
+
+    const auto operator!=(const bitboard& other) const noexcept {
+      return _words != other._words;
+    }
+
+    // 立っているビットの添字ごとに、fを呼び出します。
+    template <typename F>
+    void for_each(F&& f) const noexcept {
+      for (auto i = static_cast<std::size_t>(0); i < _words.size(); ++i) {
+        for (auto word = _words[i]; word; word &= word - 1) {
+          f(i * 64 + __builtin_ctzll(word));
+        }
+      }
+    }
+  };
+
+  template <std::size_t Width>
+  constexpr std::size_t bitboard<Width>::width;
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace hexagonal_walk {
+  // 探索の中で何が起きたかを数えます。探索のスレッドは手元の変数で数えておいて、区切りごとにまとめて足し込むので、順序付けのない加算で十分です。
+  class counter {
+    std::atomic<std::uint64_t> _value;
+
+  public:
+    counter() noexcept
+      : _value(0)
+    {
+      ;
+    }
+
+    void add(const std::uint64_t& value) noexcept {
+      _value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    const auto value() const noexcept {
+      return _value.load(std::memory_order_relaxed);
+    }
+  };
+
+  // 探索が終わった後に、カウンターの値を名前ごとに集めます。同じ名前の探索が複数ある場合は、合計します。
+  class counters {
+    std::mutex _mutex;
+    std::map<std::string, std::uint64_t> _values;
+
+  public:
+    counters() noexcept
+      : _mutex(), _values()
+    {
+      ;
+    }
+
+    void add(const std::string& name, const std::uint64_t& value) noexcept {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _values[name] += value;
+    }
+
+    const auto& values() const noexcept {
+      return _values;
+    }
+  };
+}
@@ -1,8 +1,295 @@
 ﻿#include "game.hpp"
 
-std::vector<hexagonal_walk::tile> hexagonal_walk::_tiles;
-std::vector<std::uint8_t> hexagonal_walk::_points;
+template <typename Coordinate, typename Index>
+void hexagonal_walk::basic_problem<Coordinate, Index>::set_adjacencies() noexcept {
+  // unordered_mapだと、タイルごとに6回もハッシュを計算しなければなりません。だから、座標から添字を引ける2次元の表を作ります。
+  const auto min_x = static_cast<std::int64_t>(boost::min_element(_tiles, [](const auto& tile_1, const auto& tile_2) { return tile_1.x() < tile_2.x(); })->x());
+  const auto max_x = static_cast<std::int64_t>(boost::max_element(_tiles, [](const auto& tile_1, const auto& tile_2) { return tile_1.x() < tile_2.x(); })->x());
+  const auto min_y = static_cast<std::int64_t>(boost::min_element(_tiles, [](const auto& tile_1, const auto& tile_2) { return tile_1.y() < tile_2.y(); })->y());
+  const auto max_y = static_cast<std::int64_t>(boost::max_element(_tiles, [](const auto& tile_1, const auto& tile_2) { return tile_1.y() < tile_2.y(); })->y());
 
-std::vector<boost::container::static_vector<std::uint16_t, 6>> hexagonal_walk::_adjacencies;
-std::uint16_t hexagonal_walk::_start_index;
-std::vector<std::uint16_t> hexagonal_walk::_distances;
+  const auto width = max_x - min_x + 1;
+  const auto height = max_y - min_y + 1;
+
+  // 大きな座標がまばらに散らばっている場合は、表が大きくなりすぎるので、unordered_mapで代用します。座標がint32の両端にあるとwidth * heightはint64でも溢れるので、割り算で比較します。
+  const auto is_dense = width <= (static_cast<std::int64_t>(_tiles.size()) * 16 + (1 << 20)) / height;
+
+  // 表なら行優先の添字、unordered_mapなら上位32ビットにy、下位32ビットにxを詰めた値をキーにします。width、heightは2^32以下なので、どちらも重なりません。
+  const auto key = [&](const std::int64_t& x, const std::int64_t& y) {
+    return is_dense ? static_cast<std::uint64_t>(y * width + x) : static_cast<std::uint64_t>(y) << 32 | static_cast<std::uint64_t>(x);
+  };
+
+  std::vector<Index> indice_grid(is_dense ? width * height : 0, std::numeric_limits<Index>::max());
+  std::unordered_map<std::uint64_t, Index> indice_map(is_dense ? 0 : _tiles.size());
+
+  for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
+    if (is_dense) {
+      indice_grid[key(_tiles[i].x() - min_x, _tiles[i].y() - min_y)] = i;
+    } else {
+      indice_map.emplace(key(_tiles[i].x() - min_x, _tiles[i].y() - min_y), i);
+    }
+  }
+
+  const auto find_index = [&](const std::uint64_t& key) {
+    if (is_dense) {
+      return indice_grid[key];
+    }
+
+    const auto& it = indice_map.find(key);
+    return it != std::end(indice_map) ? it->second : std::numeric_limits<Index>::max();
+  };
+
+  static const std::array<std::array<int, 2>, 6> directions{{{1, 0}, {1, -1}, {0, -1}, {-1, 0}, {-1, 1}, {0, 1}}};
+
+  _adjacencies = std::vector<adjacency_type>(_tiles.size());
+
+  for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
+    auto& adjacency = _adjacencies[i];
+
+    for (const auto& direction : directions) {
+      const auto x = _tiles[i].x() - min_x + direction[0];
+      const auto y = _tiles[i].y() - min_y + direction[1];
+
+      if (x < 0 || x >= width || y < 0 || y >= height) {
+        continue;
+      }
+
+      const auto index = find_index(key(x, y));
+      if (index == std::numeric_limits<Index>::max()) {
+        continue;
+      }
+
+      adjacency._indice[adjacency._size++] = index;
+    }
+
+    std::sort(std::begin(adjacency._indice), std::begin(adjacency._indice) + adjacency._size);
+
+    adjacency._point = _points[i];
+  }
+}
+
+template <typename Coordinate, typename Index>
+void hexagonal_walk::basic_problem<Coordinate, Index>::set_start_index() noexcept {
+  _start_index = std::distance(std::begin(_points), boost::find(_points, 0));
+}
+
+template <typename Coordinate, typename Index>
+void hexagonal_walk::basic_problem<Coordinate, Index>::set_distances() noexcept {
+  // 穴が多い盤面では、座標上の距離は実際に歩く距離よりずっと短くなります。だから、スタートから幅優先探索して、盤面上の距離を求めます。
+  constexpr auto none = std::numeric_limits<Index>::max();
+
+  for (auto& adjacency : _adjacencies) {
+    adjacency._distance = none;
+  }
+
+  std::vector<Index> queue; queue.reserve(_tiles.size());
+
+  _adjacencies[_start_index]._distance = 0;
+  queue.emplace_back(_start_index);
+
+  for (auto i = 0; i < static_cast<int>(queue.size()); ++i) {
+    const auto& adjacency = _adjacencies[queue[i]];
+
+    for (const auto& adjacency_index : adjacency) {
+      if (_adjacencies[adjacency_index]._distance != none) {
+        continue;
+      }
+
+      _adjacencies[adjacency_index]._distance = adjacency._distance + 1;
+      queue.emplace_back(adjacency_index);
+    }
+  }
+
+  // 辿り着けないタイルは、一番遠いタイルよりも遠くにあることにします。
+  const auto unreachable_distance = static_cast<Index>(_adjacencies[queue.back()]._distance + 1);
+
+  for (auto& adjacency : _adjacencies) {
+    if (adjacency._distance == none) {
+      adjacency._distance = unreachable_distance;
+    }
+  }
+}
+
+template <typename Coordinate, typename Index>
+void hexagonal_walk::basic_problem<Coordinate, Index>::set_start_components() noexcept {
+  // Tarjanの方法で、深さ優先探索一回（線形時間）で求めます。盤面が大きいと再帰が深くなりすぎるので、明示的なスタックを使います。
+  // スタートの隣のタイルは、行って戻るだけの経路があるので、橋の先でも成分になります（スタートとの二つだけの成分です）。
+  constexpr auto none = std::numeric_limits<Index>::max();
+
+  std::vector<std::vector<Index>> result;
+
+  std::vector<Index> orders(_tiles.size(), none);  // 深さ優先探索で訪問した順番です。
+  std::vector<Index> lows(_tiles.size(), none);    // 子孫から後退辺で辿り着ける、一番小さな順番です。
+  std::vector<Index> parents(_tiles.size(), none);
+  std::vector<std::uint8_t> next_positions(_tiles.size(), 0);
+
+  std::vector<Index> stack; stack.reserve(_tiles.size());                      // 探索中のタイルです。
+  std::vector<Index> component_stack; component_stack.reserve(_tiles.size());  // まだどの二重連結成分にも割り当てていないタイルです。
+
+  auto order = static_cast<Index>(0);
+
+  orders[_start_index] = lows[_start_index] = order++;
+  stack.emplace_back(_start_index);
+
+  while (!stack.empty()) {
+    const auto index = stack.back();
+    const auto& adjacency = _adjacencies[index];
+
+    if (next_positions[index] < adjacency.size()) {
+      const auto adjacency_index = adjacency[next_positions[index]++];
+
+      if (orders[adjacency_index] == none) {
+        orders[adjacency_index] = lows[adjacency_index] = order++;
+        parents[adjacency_index] = index;
+
+        stack.emplace_back(adjacency_index);
+        component_stack.emplace_back(adjacency_index);
+      } else if (adjacency_index != parents[index]) {
+        lows[index] = std::min(lows[index], orders[adjacency_index]);
+      }
+
+      continue;
+    }
+
+    stack.pop_back();
+
+    if (index == _start_index) {
+      break;
+    }
+
+    const auto parent = parents[index];
+    lows[parent] = std::min(lows[parent], lows[index]);
+
+    // indexより上に戻る後退辺がないなら、parentとindexの部分木の残りで一つの二重連結成分です。parentがスタートの場合だけ集めます。
+    if (lows[index] >= orders[parent]) {
+      std::vector<Index> component;
+
+      while (true) {
+        const auto component_index = component_stack.back(); component_stack.pop_back();
+
+        if (parent == _start_index) {
+          component.emplace_back(component_index);
+        }
+
+        if (component_index == index) {
+          break;
+        }
+      }
+
+      if (parent == _start_index) {
+        boost::sort(component);
+        result.emplace_back(std::move(component));
+      }
+    }
+  }
+
+  _start_components = std::move(result);
+}
+
+template <typename Coordinate, typename Index>
+hexagonal_walk::question hexagonal_walk::basic_problem<Coordinate, Index>::partial_question(const std::vector<Index>& indice) const noexcept {
+  std::vector<basic_tile<std::int32_t>> tiles; tiles.reserve(indice.size() + 1);
+  std::vector<std::uint8_t> points; points.reserve(indice.size() + 1);
+
+  tiles.emplace_back(_tiles[_start_index].x(), _tiles[_start_index].y());
+  points.emplace_back(_points[_start_index]);
+
+  for (const auto& index : indice) {
+    tiles.emplace_back(_tiles[index].x(), _tiles[index].y());
+    points.emplace_back(_points[index]);
+  }
+
+  return question(std::move(tiles), std::move(points));
+}
+
+template <typename Coordinate, typename Index>
+hexagonal_walk::basic_problem<Coordinate, Index>::basic_problem(const question& question) noexcept
+  : _tiles(), _points(question.points()), _adjacencies(), _start_index(0), _start_components()
+{
+  // スタート（ポイントが0のタイル）がない盤面では歩けないので、空の問題にします。
+  if (question.empty() || boost::find(question.points(), 0) == std::end(question.points())) {
+    _points.clear();
+    return;
+  }
+
+  _tiles.reserve(question.tiles().size());
+  for (const auto& tile : question.tiles()) {
+    _tiles.emplace_back(tile.x(), tile.y());
+  }
+
+  // ポイント面で到達不可能（2がないのに3がある等）なタイルを除去します。
+  {
+    const auto max_point = [&]() {
+      const auto point_set = boost::copy_range<std::unordered_set<std::uint8_t>>(_points);
+
+      for (auto i = static_cast<std::uint8_t>(2); i < point_set.size(); ++i) {
+        if (point_set.find(i) == std::end(point_set)) {
+          return i;
+        }
+      }
+
+      return static_cast<std::uint8_t>(point_set.size());
+    }();
+
+    std::vector<tile_type> tiles; tiles.reserve(_tiles.size());
+    std::vector<std::uint8_t> points; points.reserve(_points.size());
+    for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
+      if (_points[i] > max_point) {
+        continue;
+      }
+
+      tiles.emplace_back(_tiles[i]);
+      points.emplace_back(_points[i]);
+    }
+
+    _tiles = std::move(tiles);
+    _points = std::move(points);
+  }
+
+  set_adjacencies();
+  set_start_index();
+  set_start_components();
+
+  // スタートを通る単純な閉路に乗らないタイルを除去します。閉路は一つの二重連結成分に収まるので、スタートを含む二重連結成分のタイルだけを残せば十分です。
+  {
+    boost::dynamic_bitset<> connected_indice_bitset(_tiles.size());
+    connected_indice_bitset[_start_index] = true;
+
+    for (const auto& component : _start_components) {
+      for (const auto& index : component) {
+        connected_indice_bitset[index] = true;
+      }
+    }
+
+    std::vector<tile_type> tiles; tiles.reserve(_tiles.size());
+    std::vector<std::uint8_t> points; points.reserve(_points.size());
+    std::vector<Index> indice_map(_tiles.size());  // 除去する前の添字から、除去した後の添字への対応です。
+    for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
+      if (!connected_indice_bitset[i]) {
+        continue;
+      }
+
+      indice_map[i] = tiles.size();
+
+      tiles.emplace_back(_tiles[i]);
+      points.emplace_back(_points[i]);
+    }
+
+    _tiles = std::move(tiles);
+    _points = std::move(points);
+
+    // タイルの順序は変わらないので、成分の添字を付け替えるだけで、成分を求め直す必要はありません。
+    for (auto& component : _start_components) {
+      for (auto& index : component) {
+        index = indice_map[index];
+      }
+    }
+  }
+
+  set_adjacencies();
+  set_start_index();
+  set_distances();
+}
+
+template class hexagonal_walk::basic_problem<std::uint8_t, std::uint16_t>;
+template class hexagonal_walk::basic_problem<std::int32_t, std::uint32_t>;
@@ -1,14 +1,17 @@
 ﻿#pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <unordered_map>
 #include <unordered_set>
-#include <queue>
-#include <stack>
+#include <string>
 #include <vector>
 
+#include <boost/algorithm/cxx11/all_of.hpp>
 #include <boost/container/static_vector.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/range/adaptors.hpp>
@@ -17,311 +20,344 @@
 #include <boost/range/numeric.hpp>
 
 namespace hexagonal_walk {
-  class tile {
-    union {
-      const std::uint8_t _values[2];
-      const std::uint16_t _value;
-    };
+  // 座標の型は、盤面の大きさに合わせて選びます。
+  template <typename Coordinate>
+  class basic_tile {
+    const Coordinate _x;
+    const Coordinate _y;
 
   public:
-    tile(const std::uint8_t& x, const std::uint8_t& y) noexcept
-      : _values{y, x}
+    basic_tile(const Coordinate& x, const Coordinate& y) noexcept
+      : _x(x), _y(y)
     {
       ;
     }
 
     const auto& x() const noexcept {
-      return _values[1];
+      return _x;
     }
 
     const auto& y() const noexcept {
-      return _values[0];
+      return _y;
     }
 
-    const auto around_tiles() const noexcept {
-      return std::array<tile, 6>{tile(x() + 1, y()), tile(x() + 1, y() - 1), tile(x(), y() - 1), tile(x() - 1, y()), tile(x() - 1, y() + 1), tile(x(), y() + 1)};
+    const auto operator==(const basic_tile& other) const noexcept {
+      return _x == other._x && _y == other._y;
     }
-
-    const auto operator==(const tile& other) const noexcept {
-      return _value == other._value;
-    }
-
-    friend std::hash<hexagonal_walk::tile>;
   };
 
-  inline std::ostream& operator<<(std::ostream& stream, const tile& tile) {
+  template <typename Coordinate>
+  inline std::ostream& operator<<(std::ostream& stream, const basic_tile<Coordinate>& tile) {
     return stream << static_cast<int>(tile.x()) << "," << static_cast<int>(tile.y());
   }
 
   class cubed_tile {
-    const int _cube_x;
-    const int _cube_z;
-    const int _cube_y;
+    const std::int64_t _cube_x;
+    const std::int64_t _cube_z;
+    const std::int64_t _cube_y;
 
   public:
-    cubed_tile(const tile& tile) noexcept
+    template <typename Coordinate>
+    cubed_tile(const basic_tile<Coordinate>& tile) noexcept
       : _cube_x(tile.x()), _cube_z(tile.y()), _cube_y(0 - _cube_x - _cube_z)
     {
       ;
     }
 
-    int distance(const cubed_tile& other) const noexcept {
+    std::int64_t distance(const cubed_tile& other) const noexcept {
       return (std::abs(_cube_x - other._cube_x) + std::abs(_cube_y - other._cube_y) + std::abs(_cube_z - other._cube_z)) / 2;
     }
   };
-}
 
-namespace std {
-  template <>
-  struct hash<hexagonal_walk::tile> {
-    std::size_t operator()(const hexagonal_walk::tile& tile) const {
-      return tile._value;
+  // 読み込んだままの問題です。盤面の大きさが分かるまで型を決められないので、大きな座標の型で保持します。
+  class question {
+    std::vector<basic_tile<std::int32_t>> _tiles;
+    std::vector<std::uint8_t> _points;
+
+  public:
+    question(std::vector<basic_tile<std::int32_t>>&& tiles, std::vector<std::uint8_t>&& points) noexcept
+      : _tiles(std::move(tiles)), _points(std::move(points))
+    {
+      ;
+    }
+
+    const auto& tiles() const noexcept {
+      return _tiles;
+    }
+
+    const auto& points() const noexcept {
+      return _points;
+    }
+
+    const auto empty() const noexcept {
+      return _tiles.empty();
     }
   };
-}
 
-namespace hexagonal_walk {
-  extern std::vector<tile> _tiles;
-  extern std::vector<std::uint8_t> _points;
-
-  extern std::vector<boost::container::static_vector<std::uint16_t, 6>> _adjacencies;
-  extern std::uint16_t _start_index;
-  extern std::vector<std::uint16_t> _distances;
-
-  inline const auto read_question() noexcept {
-    auto set_adjacencies = []() {
-      const auto indice_map = boost::copy_range<std::unordered_map<tile, std::uint16_t>>(
-        _tiles |
-        boost::adaptors::indexed() |
-        boost::adaptors::transformed(
-          [](const auto& indexed_tile) {
-            return std::make_pair(indexed_tile.value(), indexed_tile.index());
-          }));
-
-      // vector<vector>だとメモリが連続しないので、CPUのキャッシュにのる可能性が減る……ような気がします。vector<static_vector>に変更してみます。
-      // _adjacencies = boost::copy_range<std::vector<std::vector<std::uint16_t>>>(
-      //   _tiles |
-      //   boost::adaptors::transformed(
-      //     [&](const auto& tile) {
-      //       auto result = boost::copy_range<std::vector<std::uint16_t>>(
-      //         tile.around_tiles() |
-      //         boost::adaptors::transformed(
-      //           [&](const auto& around_tile) {
-      //             return indice_map.find(around_tile);
-      //           }) |
-      //         boost::adaptors::filtered(
-      //           [&](const auto& indice_map_it) {
-      //             return indice_map_it != std::end(indice_map);
-      //           }) |
-      //         boost::adaptors::transformed(
-      //           [&](const auto& indice_map_it) { return indice_map_it->second; }));
-      //
-      //       boost::sort(result);
-      //
-      //       return result;
-      //     }));
-
-      _adjacencies = std::vector<boost::container::static_vector<std::uint16_t, 6>>(_tiles.size());
-
-      // static_vectorはムーブができません。だから、直接構築してみます。
-      for (const auto& indexed_tile : _tiles | boost::adaptors::indexed()) {
-        for (const auto& around_tile : indexed_tile.value().around_tiles()) {
-          const auto& indice_map_it = indice_map.find(around_tile);
-          if (indice_map_it == std::end(indice_map)) {
-            continue;
-          }
-          _adjacencies[indexed_tile.index()].emplace_back(indice_map_it->second);
-        }
+  template <typename Coordinate, typename Index>
+  class basic_problem;
 
-        boost::sort(_adjacencies[indexed_tile.index()]);
-      }
-    };
+  // 隣接するタイルの一覧に、タイル自身のポイントとスタートからの距離を加えた、固定長のレコードです。探索では全部を続けて参照するので、2のべき乗の大きさにまとめてキャッシュ・ラインをまたがないようにしました。
+  template <typename Index>
+  class alignas(sizeof(Index) * 8) basic_adjacency {
+    std::array<Index, 6> _indice;
+    std::uint8_t _size;
+    std::uint8_t _point;
+    Index _distance;
+
+  public:
+    using iterator = typename std::array<Index, 6>::const_iterator;  // Boost.Rangeのアルゴリズムで使えるように、型を定義しておきます。
+    using const_iterator = typename std::array<Index, 6>::const_iterator;
 
-    auto set_start_index = []() {
-      _start_index = std::distance(std::begin(_points), boost::find(_points, 0));
-    };
+    basic_adjacency() noexcept
+      : _indice(), _size(0), _point(0), _distance(0)
+    {
+      ;
+    }
 
-    auto set_distances = []() {
-      const cubed_tile start_cubed_tile(_tiles[_start_index]);
+    const_iterator begin() const noexcept {
+      return std::begin(_indice);
+    }
 
-      _distances = boost::copy_range<std::vector<std::uint16_t>>(
-        _tiles |
-        boost::adaptors::transformed(
-          [&](const auto& tile) {
-            return static_cast<std::uint16_t>(start_cubed_tile.distance(cubed_tile(tile)));
-          }));
-    };
+    const_iterator end() const noexcept {
+      return std::begin(_indice) + _size;
+    }
 
-    _tiles.reserve(20000);
-    _points.reserve(20000);
+    const auto size() const noexcept {
+      return static_cast<std::size_t>(_size);
+    }
 
-    while (std::cin) {
-      int x, y, point; char comma;
-      std::cin >> x >> comma >> y >> comma >> point;
+    const auto& operator[](const std::size_t& index) const noexcept {
+      return _indice[index];
+    }
 
-      if (std::cin.fail()) {
-        continue;
-      }
+    const auto& point() const noexcept {
+      return _point;
+    }
 
-      _tiles.emplace_back(tile(x, y));
-      _points.emplace_back(point);
+    const auto& distance() const noexcept {
+      return _distance;
     }
 
-    // ポイント面で到達不可能（2がないのに3がある等）なタイルを除去します。
-    {
-      const auto max_point = []() {
-        const auto point_set = boost::copy_range<std::unordered_set<std::uint8_t>>(_points);
+    template <typename Coordinate, typename>
+    friend class basic_problem;
+  };
 
-        for (auto i = static_cast<std::uint8_t>(2); i < point_set.size(); ++i) {
-          if (point_set.find(i) == std::end(point_set)) {
-            return i;
-          }
-        }
+  static_assert(sizeof(basic_adjacency<std::uint16_t>) == 16, "basic_adjacency<std::uint16_t> should fit in a quarter of a cache line.");
+  static_assert(sizeof(basic_adjacency<std::uint32_t>) == 32, "basic_adjacency<std::uint32_t> should fit in a half of a cache line.");
 
-        return static_cast<std::uint8_t>(point_set.size());
-      }();
+  // 盤面の状態をグローバル変数で持つと、複数の問題を同時に解けません。だから、問題をひとまとめにしたクラスを作成しました。
+  template <typename Coordinate, typename Index>
+  class basic_problem {
+  public:
+    using tile_type = basic_tile<Coordinate>;
+    using index_type = Index;
+    using adjacency_type = basic_adjacency<Index>;
 
-      std::vector<tile> tiles; tiles.reserve(_tiles.size());
-      std::vector<std::uint8_t> points; points.reserve(_points.size());
-      for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
-        if (_points[i] > max_point) {
-          continue;
-        }
+  private:
+    std::vector<tile_type> _tiles;
+    std::vector<std::uint8_t> _points;
 
-        tiles.emplace_back(_tiles[i]);
-        points.emplace_back(_points[i]);
-      }
+    std::vector<adjacency_type> _adjacencies;
+    Index _start_index;
+    std::vector<std::vector<Index>> _start_components;
+
+    void set_adjacencies() noexcept;
+    void set_start_index() noexcept;
+    void set_start_components() noexcept;
+    void set_distances() noexcept;
 
-      _tiles = std::move(tiles);
-      _points = std::move(points);
+  public:
+    explicit basic_problem(const question& question) noexcept;
+
+    // スタートとindiceのタイルだけの問題です。
+    question partial_question(const std::vector<Index>& indice) const noexcept;
+
+    // 座標がCoordinateに収まり、添字（と、番兵としての最大値）がIndexに収まるなら、この型で問題を表現できます。
+    static auto fits(const question& question) noexcept {
+      return
+        question.tiles().size() <= std::numeric_limits<Index>::max() &&
+        boost::algorithm::all_of(
+          question.tiles(),
+          [](const auto& tile) {
+            return
+              tile.x() >= std::numeric_limits<Coordinate>::min() && tile.x() <= std::numeric_limits<Coordinate>::max() &&
+              tile.y() >= std::numeric_limits<Coordinate>::min() && tile.y() <= std::numeric_limits<Coordinate>::max();
+          });
     }
 
-    set_adjacencies();
-    set_start_index();
+    const auto& tiles() const noexcept {
+      return _tiles;
+    }
 
-    // 明らかに到達不可能なタイルを除去します。
-    {
-      boost::dynamic_bitset<> connected_indice_bitset(_tiles.size());
-      connected_indice_bitset[_start_index] = true;
+    const auto& points() const noexcept {
+      return _points;
+    }
 
-      std::vector<std::uint16_t> oneway_entrance_indice; oneway_entrance_indice.reserve(_tiles.size());
+    const auto& adjacencies() const noexcept {
+      return _adjacencies;
+    }
 
-      // とりあえず、一方通行が「含まれない」エリアを探します。
-      {
-        std::queue<std::uint16_t> queue;
-        for (const auto& adjacency_index : _adjacencies[_start_index]) {
-          queue.emplace(adjacency_index);
-          connected_indice_bitset[adjacency_index] = true;
-        }
+    const auto& start_index() const noexcept {
+      return _start_index;
+    }
 
-        while (!queue.empty()) {
-          const auto index = queue.front(); queue.pop();
+    // スタートを含む二重連結成分ごとの、スタート以外のタイルの添字（昇順）です。スタートを通る閉路は、どれか一つの成分に収まります。
+    const auto& start_components() const noexcept {
+      return _start_components;
+    }
 
-          for (const auto& adjacency_index : _adjacencies[index]) {
-            if (connected_indice_bitset[adjacency_index]) {
-              continue;
-            }
+    const auto empty() const noexcept {
+      return _tiles.empty();
+    }
+  };
 
-            bool can_return = [&]() {
-              auto connected_count = 0;
+  // これまで通りの、8ビットの座標と16ビットの添字の問題です。小さな盤面では、こちらを使用します。
+  using problem = basic_problem<std::uint8_t, std::uint16_t>;
 
-              for (const auto& adjacency_adjacency_index : _adjacencies[adjacency_index]) {
-                if (connected_indice_bitset[adjacency_adjacency_index]) {
-                  if (++connected_count >= 2) {
-                    return true;
-                  }
-                }
-              }
+  // 255×255を超える座標や、65535を超えるタイルを含む盤面の問題です。
+  using large_problem = basic_problem<std::int32_t, std::uint32_t>;
 
-              return false;
-            }();
+  extern template class basic_problem<std::uint8_t, std::uint16_t>;
+  extern template class basic_problem<std::int32_t, std::uint32_t>;
 
-            if (!can_return) {
-              oneway_entrance_indice.emplace_back(adjacency_index);
-              continue;
-            }
+  // 問題に合った型で盤面を構築して、fを呼び出します。fは、どちらの型でも呼び出せる必要があります。
+  template <typename F>
+  inline auto visit_problem(const question& question, F&& f) noexcept {
+    if (problem::fits(question)) {
+      return f(problem(question));
+    }
 
-            connected_indice_bitset[adjacency_index] = true;
+    return f(large_problem(question));
+  }
 
-            queue.emplace(adjacency_index);
-          }
-        }
-      }
+  // std::istreamの>>は1項目ずつ書式を解釈するので遅いです。だから、整数の読み込みを自前で実装しました。>>と同じく、intに収まらない値は読み込みに失敗させます。
+  inline auto scan_integer(const char*& it, const char* end, int& value) noexcept {
+    while (it != end && (*it == ' ' || *it == '\t')) {
+      ++it;
+    }
 
-      // 2箇所以上で繋がっていれば、一方通行の先を救済します。その先に一方通行があっても、計算コストが高いので無視して取り込みます。
-      {
-        for (const auto& oneway_entrance_index : oneway_entrance_indice) {
-          if (connected_indice_bitset[oneway_entrance_index]) {
-            continue;
-          }
+    const auto negative = it != end && *it == '-';
+    if (it != end && (*it == '-' || *it == '+')) {
+      ++it;
+    }
 
-          std::stack<std::uint16_t> stack;
-          stack.emplace(oneway_entrance_index);
+    if (it == end || *it < '0' || *it > '9') {
+      return false;
+    }
 
-          boost::dynamic_bitset<> maybe_connected_indice_bitset(_tiles.size());
-          maybe_connected_indice_bitset[oneway_entrance_index] = true;
+    // 桁が多すぎてもstd::int64_tが溢れないように、上限を超えたら上限で止めて、残りの桁は読み飛ばします。
+    const auto limit = static_cast<std::int64_t>(std::numeric_limits<int>::max()) + (negative ? 1 : 0);
 
-          auto connected_count = 0;
-          while (!stack.empty()) {
-            const auto index = stack.top(); stack.pop();
+    auto result = static_cast<std::int64_t>(0);
+    for (; it != end && *it >= '0' && *it <= '9'; ++it) {
+      result = std::min(result * 10 + (*it - '0'), limit + 1);
+    }
 
-            for (const auto& adjacency_index : _adjacencies[index]) {
-              if (maybe_connected_indice_bitset[adjacency_index]) {
-                continue;
-              }
+    if (result > limit) {
+      return false;
+    }
 
-              if (connected_indice_bitset[adjacency_index]) {
-                connected_count++;
-                continue;
-              }
+    value = static_cast<int>(negative ? -result : result);
 
-              maybe_connected_indice_bitset[adjacency_index] = true;
+    return true;
+  }
 
-              stack.emplace(adjacency_index);
-            }
-          }
+  inline auto scan_comma(const char*& it, const char* end) noexcept {
+    while (it != end && (*it == ' ' || *it == '\t')) {
+      ++it;
+    }
 
-          if (connected_count >= 2) {
-            connected_indice_bitset |= maybe_connected_indice_bitset;
-          }
+    if (it == end || *it != ',') {
+      return false;
+    }
+
+    ++it;
+
+    return true;
+  }
+
+  // 「x,y,point」形式の1行を読み込みます。行末の余計な文字は、>>と同様に無視します。
+  inline auto scan_tile_line(const char* it, const char* end, int& x, int& y, int& point) noexcept {
+    return scan_integer(it, end, x) && scan_comma(it, end) && scan_integer(it, end, y) && scan_comma(it, end) && scan_integer(it, end, point);
+  }
+
+  inline auto is_blank_line(const char* it, const char* end) noexcept {
+    return std::all_of(it, end, [](const auto& c) { return c == ' ' || c == '\t' || c == '\r'; });
+  }
+
+  // [it, end)から、解釈できない行までを一つの問題として読み込みます。itは、読み込んだ行の次に進めます。
+  // 一つのファイルには一つの問題しかないので、元の>>での読み込みと同じく、空行は途中にあっても読み飛ばします（問題を空行で区切るのは、ストリームのバッチ・モードだけです）。
+  inline auto read_question(const char*& it, const char* end) noexcept {
+    std::vector<basic_tile<std::int32_t>> tiles; tiles.reserve(20000);
+    std::vector<std::uint8_t> points; points.reserve(20000);
+
+    while (it != end) {
+      const auto line_begin = it;
+      const auto line_end = [&]() {
+        const auto result = static_cast<const char*>(std::memchr(line_begin, '\n', end - line_begin));
+        return result ? result : end;
+      }();
+
+      it = line_end == end ? end : line_end + 1;
+
+      int x, y, point;
+      if (!scan_tile_line(line_begin, line_end, x, y, point)) {
+        if (is_blank_line(line_begin, line_end)) {
+          continue;
         }
+
+        break;
       }
 
-      std::vector<tile> tiles; tiles.reserve(_tiles.size());
-      std::vector<std::uint8_t> points; points.reserve(_points.size());
-      for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
-        if (!connected_indice_bitset[i]) {
+      tiles.emplace_back(x, y);
+      points.emplace_back(point);
+    }
+
+    return question(std::move(tiles), std::move(points));
+  }
+
+  // 空行で区切られた問題が次々に流れてくる場合は、全体を読み込むまで待てないので、行単位でstreamを消費します。
+  inline auto read_question(std::istream& stream) noexcept {
+    std::vector<basic_tile<std::int32_t>> tiles; tiles.reserve(20000);
+    std::vector<std::uint8_t> points; points.reserve(20000);
+
+    std::string line;
+    while (std::getline(stream, line)) {
+      const auto line_begin = line.data();
+      const auto line_end = line.data() + line.size();
+
+      int x, y, point;
+      if (!scan_tile_line(line_begin, line_end, x, y, point)) {
+        if (tiles.empty() && is_blank_line(line_begin, line_end)) {
           continue;
         }
 
-        tiles.emplace_back(_tiles[i]);
-        points.emplace_back(_points[i]);
+        break;
       }
 
-      _tiles = std::move(tiles);
-      _points = std::move(points);
+      tiles.emplace_back(x, y);
+      points.emplace_back(point);
     }
 
-    set_adjacencies();
-    set_start_index();
-    set_distances();
+    return question(std::move(tiles), std::move(points));
   }
 
-  template <typename T>
-  __forceinline /*inline*/ const auto point(const T& indice) noexcept {
+  template <typename Problem, typename T>
+  inline const auto point(const Problem& problem, const T& indice) noexcept {
     return boost::accumulate(
       indice |
       boost::adaptors::transformed(
-        [](const auto& index) {
-          return _points[index];
+        [&](const auto& index) {
+          return problem.points()[index];
         }),
       0);
   }
 
-  template <typename T>
-  inline const auto write_answer(const T& indice) noexcept {
+  template <typename Problem, typename T>
+  inline const auto write_answer(std::ostream& stream, const Problem& problem, const T& indice) noexcept {
     for (const auto& index : indice) {
-      std::cout << _tiles[index] << std::endl;
+      stream << problem.tiles()[index] << std::endl;
     }
   }
 }
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+namespace hexagonal_walk {
+  // 全ての探索で共有する、これまでで最良の解です。差し替えも取得もたまにしか起きないので、普通のミューテックスで守ります。解は書き換えずに丸ごと差し替えるので、取得した解はロックの外でも使えます。
+  template <typename Index>
+  class incumbent {
+  public:
+    class solution {
+      std::vector<Index> _indice;
+      int _point;
+
+    public:
+      solution(const std::vector<Index>& indice, const int& point) noexcept
+        : _indice(indice), _point(point)
+      {
+        ;
+      }
+
+      const auto& indice() const noexcept {
+        return _indice;
+      }
+
+      const auto& point() const noexcept {
+        return _point;
+      }
+    };
+
+  private:
+    std::shared_ptr<const solution> _solution;
+    mutable std::mutex _mutex;
+    std::atomic<int> _point;        // ロックも解の取得もせずに比較できるように、ポイントだけ別に持ちます。
+    hexagonal_walk::trace* _trace;  // 改善を、改善したスレッドの出来事として記録します。
+
+  public:
+    explicit incumbent(hexagonal_walk::trace* trace = nullptr) noexcept
+      : _solution(), _mutex(), _point(0), _trace(trace)
+    {
+      ;
+    }
+
+    // pointが今の解より大きければ、indiceを新しい解にします。差し替えた場合はtrueを返します。
+    const auto publish(const std::vector<Index>& indice, const int& point) noexcept {
+      if (point <= _point.load(std::memory_order_relaxed)) {
+        return false;
+      }
+
+      const auto next_solution = std::make_shared<const solution>(indice, point);  // 解のコピーは、ロックの外で作ります。
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_solution && _solution->point() >= point) {
+          return false;
+        }
+
+        _solution = next_solution;
+        _point.store(point, std::memory_order_relaxed);
+      }
+
+      if (_trace) {
+        _trace->instant("improvement", "\"point\": " + std::to_string(point) + ", \"length\": " + std::to_string(indice.size()));
+      }
+
+      return true;
+    }
+
+    const auto get() const noexcept {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      return _solution;
+    }
+
+    const auto point() const noexcept {
+      return _point.load(std::memory_order_relaxed);
+    }
+  };
+}
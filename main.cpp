@@ -1,185 +1,716 @@
-﻿#include <future>
+﻿#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
-
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/range/algorithm.hpp>
+
+#include "counters.hpp"
 #include "game.hpp"
+#include "incumbent.hpp"
+#include "mapped_file.hpp"
+#include "random.hpp"
+#include "scheduler.hpp"
 #include "solver.hpp"
+#include "thread_pool.hpp"
+#include "timings.hpp"
+#include "trace.hpp"
 
-int main(int argc, char** argv) {
-  const auto starting_time = std::chrono::steady_clock::now();
+namespace {
+  template <typename Problem, typename ThreadPool>
+  const auto solve_component(const Problem& problem, const std::string& name, const int& threads, const std::uint64_t& seed, const hexagonal_walk::scheduler& scheduler, ThreadPool& thread_pool, hexagonal_walk::timings& timings, hexagonal_walk::counters& counters) noexcept {
+    hexagonal_walk::incumbent<typename Problem::index_type> incumbent(timings.trace());  // 全ての探索が、見つけた解をここに書き込みます。
 
-  std::cin.tie(0);
-  std::ios::sync_with_stdio(false);
+    // 回数で打ち切る場合は、結果が探索の間のタイミングに左右されないように、解を共有しません。ビーム・サーチも、重複の判定がスレッドの順序に左右されるので1スレッドにします。
+    const auto& iteration_limit = scheduler.iteration_limit();
+    const auto shared_incumbent = iteration_limit ? nullptr : &incumbent;
+    const auto beam_search_threads = iteration_limit ? 1 : threads;
 
-  hexagonal_walk::read_question();
+    // 探索ごとのシードは、呼び出し元のスレッドで順番に作ります。
+    auto seed_state = seed;
+    const auto next_seed = [&]() {
+      return hexagonal_walk::splitmix64(seed_state);
+    };
 
-  const auto result_1 = [&]() {
-    hexagonal_walk::depth_first_search depth_first_search;
-    auto depth_first_search_future = std::async(
-      std::launch::async,
-      [&]() {
-        return depth_first_search();
-      });
+    // 各ステージの解と、共有の解の良い方です。
+    const auto better = [&](const std::vector<typename Problem::index_type>& indice) {
+      const auto& solution = incumbent.get();
 
-    hexagonal_walk::fattening fattening;
-    auto fattening_future = std::async(
-      std::launch::async,
-      [&]() {
-        return fattening();
-      });
+      if (!solution || solution->point() <= hexagonal_walk::point(problem, indice)) {
+        return indice;
+      }
 
-    hexagonal_walk::beam_search beam_search;
-    auto beam_search_future = std::async(
-      std::launch::async,
-      [&]() {
-        return beam_search();
-      });
+      return solution->indice();
+    };
+
+    // レプリカ交換法の温度の数は、コアの数に関わらず4つにします（シードが同じなら、どのマシンでも同じ温度で探索します）。
+    // ステージ2と3では、他に3つの探索がスレッド・プールで動いているので、レプリカを動かすスレッドは残りのコアの分だけにします。コアが少なければ、1つのスレッドで全てのレプリカを順に動かします。
+    const auto replica_size = 4;
+    const auto replica_threads = std::max(threads - 3, 1);
+
+    // ポイントの上限に達した解は最適なので、そこで打ち切ります。全てのタイルを巡る解も、上限に達しています。
+    const auto upper_bound = hexagonal_walk::point_upper_bound(problem);
+    counters.add(name + "upper_bound", upper_bound);  // 上限は成分ごとに違うので、足し合わせずに成分ごとの名前で記録します。
+
+    const auto solved = [&](const std::vector<typename Problem::index_type>& indice) {
+      return hexagonal_walk::point(problem, indice) >= upper_bound;
+    };
+
+    const std::function<bool()> finished = [&]() {
+      return incumbent.point() >= upper_bound;
+    };
+
+    auto optimal = false;  // 深さ優先探索が最後まで探索し終えたなら、その解は最適です。
+
+    const auto result_1 = [&]() -> std::vector<typename Problem::index_type> {
+      const auto stopwatch = timings.measure("stage_1");
+
+      hexagonal_walk::depth_first_search<Problem> depth_first_search(problem, shared_incumbent);
+      if (iteration_limit) {
+        depth_first_search.limit_iterations(iteration_limit);
+      }
+
+      auto depth_first_search_future = thread_pool.submit(
+        [&]() {
+          const auto stopwatch = timings.measure("stage_1.depth_first_search");
+
+          return depth_first_search();
+        });
+
+      hexagonal_walk::fattening<Problem> fattening(problem, shared_incumbent);
+      auto fattening_future = thread_pool.submit(
+        [&]() {
+          const auto stopwatch = timings.measure("stage_1.fattening");
+
+          return fattening();
+        });
+
+      hexagonal_walk::beam_search<Problem> beam_search(problem, beam_search_threads, shared_incumbent);  // 深さ優先探索とfatteningは早く終わるので、ビーム・サーチには全てのスレッドを使わせます。
+      if (iteration_limit) {
+        beam_search.limit_iterations(iteration_limit);
+      }
+
+      auto beam_search_future = thread_pool.submit(
+        [&]() {
+          const auto stopwatch = timings.measure("stage_1.beam_search");
+
+          return beam_search();
+        });
 
-    depth_first_search_future.wait_until(starting_time + std::chrono::milliseconds(50));
-    depth_first_search.stop();
-    auto depth_first_search_result = depth_first_search_future.get();
+      // スレッド・プールのfutureは、std::asyncと違ってデストラクタで終了を待ちません。探索がスコープの外で動き続けないように、止めたら必ず待ちます。
+      // 小さな盤面ほど、最後まで探索し切れる見込みが高いので長く待ちます。探索し切るまでの時間はマシンの速さ次第なので、固定の時間ではなくタイルの数で枠を決めて、遅いマシンの分の余裕も持たせます。
+      const auto depth_first_search_deadline_ratio = problem.tiles().size() <= 64 ? 0.1 : problem.tiles().size() <= 128 ? 0.05 : 0.01;
 
-    if (!depth_first_search_result.empty()) {
-      fattening.stop();
-      // fattening_future.get();
+      auto depth_first_search_result = scheduler.wait(depth_first_search_future, depth_first_search, scheduler.deadline(depth_first_search_deadline_ratio), finished);
+      depth_first_search.report(counters, "stage_1.depth_first_search");
 
-      beam_search.stop();
-      // beam_search_future.get();
+      if (!depth_first_search_result.empty()) {
+        fattening.stop();
+        fattening_future.wait();
+        fattening.report(counters, "stage_1.fattening");
 
-      hexagonal_walk::write_answer(depth_first_search_result);
-      std::quick_exit(0);
+        beam_search.stop();
+        beam_search_future.wait();
+        beam_search.report(counters, "stage_1.beam_search");
+
+        optimal = true;
+
+        return depth_first_search_result;
+      }
+
+      auto fattening_result = scheduler.wait(fattening_future, fattening, scheduler.deadline(0.1), finished);
+      fattening.report(counters, "stage_1.fattening");
+
+      if (fattening_result.size() > 500 || solved(fattening_result) || finished()) {
+        beam_search.stop();
+        beam_search_future.wait();
+        beam_search.report(counters, "stage_1.beam_search");
+
+        return better(fattening_result);
+      }
+
+      auto beam_search_result = scheduler.wait(beam_search_future, beam_search, scheduler.deadline(0.6), scheduler.deadline(0.75), false, finished);
+      beam_search.report(counters, "stage_1.beam_search");
+
+      return better(std::max(fattening_result, beam_search_result, [&](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(problem, result_1) < hexagonal_walk::point(problem, result_2); }));
+    }();
+
+    if (optimal || solved(result_1)) {
+      return result_1;
+    }
+
+    // 前のステージが締め切りを過ぎて終わった場合は、制限時間を守るために、残りのステージは始めません。
+    if (scheduler.expired(0.84)) {
+      return better(result_1);
     }
 
-    fattening_future.wait_until(starting_time + std::chrono::milliseconds(500));
-    fattening.stop();
-    auto fattening_result = fattening_future.get();
+    // local_searchは、改善が止まったら締め切りの前でも打ち切って、次のステージに時間を譲ります。まだ改善しているなら、少しだけ次のステージの時間を借ります。
+    // restartsなら、打ち切らずに、締め切りまで共有の解からやり直し続けます（回数で打ち切る場合は、やり直しません）。replica_sizesが2以上のlocal_searchは、レプリカ交換法で探索します。
+    const auto local_search_results = [&](const char* name, const std::vector<typename Problem::index_type>& indice, const std::vector<std::vector<typename Problem::index_type>>& changeable_indices, const std::vector<int>& replica_sizes, const double& deadline_ratio, const double& extended_deadline_ratio, const bool& restarts) {
+      std::vector<std::unique_ptr<hexagonal_walk::local_search<Problem>>> local_searches;
+      std::vector<std::future<std::vector<typename Problem::index_type>>> futures;
+
+      for (auto i = 0; i < static_cast<int>(changeable_indices.size()); ++i) {
+        const auto& changeable_indice = changeable_indices[i];
+
+        local_searches.emplace_back(std::make_unique<hexagonal_walk::local_search<Problem>>(problem, shared_incumbent, replica_sizes[i], replica_threads, next_seed()));
+        if (iteration_limit) {
+          local_searches.back()->limit_iterations(iteration_limit);
+        }
+
+
+        futures.emplace_back(
+          thread_pool.submit(
+            [&, name, local_search = local_searches.back().get()]() {
+              const auto stopwatch = timings.measure(name);
+
+              auto result = (*local_search)(indice, changeable_indice);
+
+              while (restarts && !iteration_limit && !local_search->stopped() && !finished() && std::chrono::steady_clock::now() < scheduler.deadline(deadline_ratio)) {
+                result = (*local_search)(better(result), changeable_indice);
+              }
+
+              return result;
+            }));
+      }
+
+      auto results = scheduler.wait(futures, local_searches, scheduler.deadline(deadline_ratio), scheduler.deadline(extended_deadline_ratio), !restarts, finished);
+      for (const auto& local_search : local_searches) {
+        local_search->report(counters, name);
+      }
+
+      return results;
+    };
+
+    const auto result_2 = [&]() {
+      const auto stopwatch = timings.measure("stage_2");
+
+      hexagonal_walk::fattening<Problem> fattening(problem, shared_incumbent);
+      auto fattening_future = thread_pool.submit(
+        [&]() {
+          const auto stopwatch = timings.measure("stage_2.fattening");
+
+          return fattening(result_1);
+        });
+
+      const auto& all_indice = hexagonal_walk::all_indice(problem);
+
+      auto results = local_search_results("stage_2.local_search", result_1, {all_indice, all_indice, all_indice}, {1, 1, replica_size}, 0.84, 0.88, false);
 
-    if (fattening_result.size() > 500) {
-      beam_search.stop();
-      // beam_search_future.get();
+      results.emplace_back(scheduler.wait(fattening_future, fattening, scheduler.deadline(0.84), finished));
+      fattening.report(counters, "stage_2.fattening");
 
-      return fattening_result;
+      return better(*boost::max_element(results, [&](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(problem, result_1) < hexagonal_walk::point(problem, result_2); }));
+    }();
+
+    if (solved(result_2) || scheduler.expired(0.92)) {
+      return result_2;
     }
 
-    beam_search_future.wait_until(starting_time + std::chrono::milliseconds(3000));
-    beam_search.stop();
-    auto beam_search_result = beam_search_future.get();
+    const auto result_3 = [&]() {
+      const auto stopwatch = timings.measure("stage_3");
 
-    return std::max(fattening_result, beam_search_result, [](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(result_1) < hexagonal_walk::point(result_2); });
-  }();
+      const auto& maybe_visitable_indice = hexagonal_walk::maybe_visitable_indice(problem, result_2);
+      const auto& all_indice = hexagonal_walk::all_indice(problem);
+
+      const auto& results = local_search_results("stage_3.local_search", result_2, {maybe_visitable_indice, maybe_visitable_indice, all_indice, all_indice}, {1, 1, 1, replica_size}, 0.92, 0.92, true);
+
+      return better(*boost::max_element(results, [&](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(problem, result_1) < hexagonal_walk::point(problem, result_2); }));
+    }();
 
-  if (result_1.size() == hexagonal_walk::_tiles.size() + 1) {
-    hexagonal_walk::write_answer(result_1);
-    std::quick_exit(0);
+
+    return result_3;
   }
 
-  const auto result_2 = [&]() {
-    hexagonal_walk::fattening fattening;
-    auto fattening_future = std::async(
-      std::launch::async,
-      [&]() {
-        return fattening(result_1);
-      });
+  // スタートを通る閉路は、スタートを含む二重連結成分のどれか一つに収まります（成分の間を行き来するには、スタートを2回通らなければなりません）。
+  // だから成分が複数あるなら、成分ごとの小さな問題に分けて並行して解いて、一番良い解を選びます。繋ぎ合わせる必要はありません。
+  // 探索はthread_poolで動かします。一つの問題が同時に動かす探索は4つまでで、成分が複数あるなら、その4つの枠とビーム・サーチのスレッドを成分で分け合います。
+  template <typename Problem>
+  const auto solve(const Problem& problem, const int& threads, const std::uint64_t& seed, const hexagonal_walk::scheduler& scheduler, hexagonal_walk::thread_pool& thread_pool, hexagonal_walk::timings& timings, hexagonal_walk::counters& counters) noexcept {
+    using index_type = typename Problem::index_type;
 
-    const auto& all_indice = hexagonal_walk::all_indice();
+    hexagonal_walk::thread_pool_share<hexagonal_walk::thread_pool> problem_thread_pool(thread_pool, 4);
 
-    hexagonal_walk::local_search local_search_1;
-    auto local_search_1_future = std::async(
-      std::launch::async,
-      [&]() {
-        return local_search_1(result_1, all_indice);
-      });
+    const auto& components = problem.start_components();
 
-    hexagonal_walk::local_search local_search_2;
-    auto local_search_2_future = std::async(
-      std::launch::async,
-      [&]() {
-        return local_search_2(result_1, all_indice);
-      });
+    if (components.size() <= 1) {
+      return solve_component(problem, "", threads, seed, scheduler, problem_thread_pool, timings, counters);
+    }
 
-    hexagonal_walk::local_search local_search_3;
-    auto local_search_3_future = std::async(
-      std::launch::async,
-      [&]() {
-        return local_search_3(result_1, all_indice);
-      });
+    // 小さな成分は深さ優先探索ですぐに解けて枠を空けるので、成分が枠より多い場合に備えて、小さい順に投入します。
+    std::vector<int> orders(components.size());
+    boost::iota(orders, 0);
+    boost::stable_sort(orders, [&](const auto& order_1, const auto& order_2) { return components[order_1].size() < components[order_2].size(); });
 
-    fattening_future.wait_until(starting_time + std::chrono::milliseconds(4200));
-    fattening.stop();
-    auto fattening_result = fattening_future.get();
+    const auto component_size = static_cast<int>(components.size());
 
-    local_search_1_future.wait_until(starting_time + std::chrono::milliseconds(4200));
-    local_search_1.stop();
-    auto local_search_1_result = local_search_1_future.get();
+    std::vector<std::vector<index_type>> results(components.size());
+    std::vector<std::thread> component_threads;  // 成分ごとに探索を投入して待つだけのスレッドです。CPUはほとんど使いません。
 
-    local_search_2_future.wait_until(starting_time + std::chrono::milliseconds(4200));
-    local_search_2.stop();
-    auto local_search_2_result = local_search_2_future.get();
+    for (auto j = 0; j < component_size; ++j) {
+      component_threads.emplace_back(
+        [&, i = orders[j], j]() {
+          const auto& component = components[i];
+          const Problem component_problem(problem.partial_question(component));
 
-    local_search_3_future.wait_until(starting_time + std::chrono::milliseconds(4200));
-    local_search_3.stop();
-    auto local_search_3_result = local_search_3_future.get();
+          if (component_problem.tiles().size() < 2) {
+            return;
+          }
 
-    return std::max({fattening_result, local_search_1_result, local_search_2_result, local_search_3_result}, [](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(result_1) < hexagonal_walk::point(result_2); });
-  }();
+          // 成分の問題のタイルは、スタート、componentの順に並んでいます。構築で除去されたタイルは飛ばして、元の問題の添字を対応させます。
+          std::vector<index_type> indice_map; indice_map.reserve(component_problem.tiles().size());
+
+          auto it = std::begin(component);
+          for (const auto& tile : component_problem.tiles()) {
+            if (tile == problem.tiles()[problem.start_index()]) {
+              indice_map.emplace_back(problem.start_index());
+              continue;
+            }
+
+            while (!(problem.tiles()[*it] == tile)) {
+              ++it;
+            }
+
+            indice_map.emplace_back(*it++);
+          }
+
+          // 4つの枠を成分で分けます。成分が4つより多い場合は1つずつにして、問題全体での上限はproblem_thread_poolに任せます。
+          hexagonal_walk::thread_pool_share<decltype(problem_thread_pool)> component_thread_pool(problem_thread_pool, 4 / component_size + (j < 4 % component_size ? 1 : 0));
 
-  if (result_2.size() == hexagonal_walk::_tiles.size() + 1) {
-    hexagonal_walk::write_answer(result_2);
-    std::quick_exit(0);
+          const auto& answer = solve_component(component_problem, "components." + std::to_string(i) + ".", std::max(threads / component_size, 1), seed + i, scheduler, component_thread_pool, timings, counters);
+
+          for (const auto& index : answer) {
+            results[i].emplace_back(indice_map[index]);
+          }
+        });
+    }
+
+    for (auto& thread : component_threads) {
+      thread.join();
+    }
+
+    return *boost::max_element(results, [&](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(problem, result_1) < hexagonal_walk::point(problem, result_2); });
   }
 
-  const auto result_3 = [&]() {
-    const auto& maybe_visitable_indice = hexagonal_walk::maybe_visitable_indice(result_2);
-    const auto& all_indice = hexagonal_walk::all_indice();
+  // 問題ごとの時間（ミリ秒）とカウンターを、1行のJSONで出力します。
+  const auto write_statistics(std::ostream& stream, const std::string& name, const hexagonal_walk::timings& timings, const hexagonal_walk::counters& counters) noexcept {
+    stream << "{\"name\": " << hexagonal_walk::json_string(name) << ", \"timings\": {";
+    for (auto it = std::begin(timings.milliseconds()); it != std::end(timings.milliseconds()); ++it) {
+      stream << (it == std::begin(timings.milliseconds()) ? "" : ", ") << hexagonal_walk::json_string(it->first) << ": " << std::fixed << std::setprecision(1) << it->second;
+    }
 
-    hexagonal_walk::local_search local_search_1;
-    auto local_search_1_future = std::async(
-      std::launch::async,
-      [&]() {
-        return local_search_1(result_2, maybe_visitable_indice);
-      });
+    stream << "}, \"counters\": {";
+    for (auto it = std::begin(counters.values()); it != std::end(counters.values()); ++it) {
+      stream << (it == std::begin(counters.values()) ? "" : ", ") << hexagonal_walk::json_string(it->first) << ": " << it->second;
+    }
 
-    hexagonal_walk::local_search local_search_2;
-    auto local_search_2_future = std::async(
-      std::launch::async,
-      [&]() {
-        return local_search_2(result_2, maybe_visitable_indice);
-      });
+    stream << "}}" << std::endl;
+  }
 
-    hexagonal_walk::local_search local_search_3;
-    auto local_search_3_future = std::async(
-      std::launch::async,
-      [&]() {
-        return local_search_3(result_2, all_indice);
-      });
+  // 複数の問題を、一つのスレッド・プールで並行して解きます。ファイルが指定されない場合は、標準入力から空行区切りで問題を読み込みます。
+  const auto solve_batch(const std::vector<const char*>& file_paths, const int& jobs, const int& threads, const std::uint64_t& seed, const std::chrono::milliseconds& budget, const std::size_t& iteration_limit, const bool& statistics, hexagonal_walk::trace* trace) noexcept {
+    std::deque<hexagonal_walk::question> questions;  // dequeなら、末尾に追加しても要素の参照は無効になりません。
+
+    hexagonal_walk::thread_pool thread_pool(jobs);                 // 問題を解くスレッドです。探索を投入して待つだけです。
+    hexagonal_walk::thread_pool search_thread_pool(jobs * 4);  // 全ての問題の探索で共有します。一つの問題は、4つまでしか使いません。
+    std::mutex statistics_mutex;  // 問題ごとのJSONの行が、混ざらないようにします。
 
-    hexagonal_walk::local_search local_search_4;
-    auto local_search_4_future = std::async(
-      std::launch::async,
+    // 入力を最後まで読むのを待たずに、解けた解答から問題の順に出力します。標準入力の読み込みはブロックするので、出力は別のスレッドでします。
+    std::deque<std::future<std::string>> futures;
+    std::mutex futures_mutex;
+    std::condition_variable futures_condition_variable;
+    auto reading = true;
+
+    std::thread writer(
       [&]() {
-        return local_search_4(result_2, all_indice);
+        while (true) {
+          std::future<std::string> future;
+
+          {
+            std::unique_lock<std::mutex> lock(futures_mutex);
+            futures_condition_variable.wait(lock, [&]() { return !futures.empty() || !reading; });
+
+            if (futures.empty()) {
+              break;
+            }
+
+            future = std::move(futures.front()); futures.pop_front();
+          }
+
+          std::cout << future.get() << std::endl;  // 解答も、空行で区切ります。
+        }
       });
 
-    local_search_1_future.wait_until(starting_time + std::chrono::milliseconds(4600));
-    local_search_1.stop();
-    auto local_search_1_result = local_search_1_future.get();
+    auto submit = [&](hexagonal_walk::question&& question) {
+      questions.emplace_back(std::move(question));
+
+      const auto& submitted_question = questions.back();
+      auto future = thread_pool.submit(
+        [&submitted_question, &threads, &seed, &budget, &iteration_limit, &statistics, &statistics_mutex, &search_thread_pool, trace, index = questions.size() - 1]() {
+          if (submitted_question.empty()) {
+            return std::string();
+          }
+
+          const auto building_time = std::chrono::steady_clock::now();
+
+          // 盤面の大きさによって問題の型が変わるので、解答は文字列にして返します。
+          return hexagonal_walk::visit_problem(
+            submitted_question,
+            [&](const auto& problem) {
+              const auto starting_time = std::chrono::steady_clock::now();
+
+              if (trace) {
+                trace->span("read_question.build", building_time, starting_time);
+              }
+
+              if (problem.empty()) {  // スタートがない盤面です。
+                return std::string();
+              }
+
+              hexagonal_walk::timings timings(trace);
+              hexagonal_walk::counters counters;
+              const auto answer = solve(problem, threads, seed, hexagonal_walk::scheduler(starting_time, budget, iteration_limit), search_thread_pool, timings, counters);  // 制限時間は、問題ごとに解き始めた時点から数えます。
+
+              if (trace) {
+                trace->span("solve", starting_time, std::chrono::steady_clock::now(), "\"index\": " + std::to_string(index));
+              }
+
+              if (statistics) {
+                std::lock_guard<std::mutex> lock(statistics_mutex);
+                write_statistics(std::cerr, std::to_string(index), timings, counters);
+              }
+
+              std::ostringstream stream;
+              hexagonal_walk::write_answer(stream, problem, answer);
+
+              return stream.str();
+            });
+        });
+
+      {
+        std::lock_guard<std::mutex> lock(futures_mutex);
+        futures.emplace_back(std::move(future));
+      }
+
+      futures_condition_variable.notify_one();
+    };
+
+    if (file_paths.empty()) {
+      while (std::cin) {
+        auto question = hexagonal_walk::read_question(std::cin);
+        if (question.empty()) {
+          continue;
+        }
+
+        submit(std::move(question));
+      }
+    } else {
+      for (const auto& file_path : file_paths) {
+        const auto parsing_time = std::chrono::steady_clock::now();
+
+        const hexagonal_walk::mapped_file file(file_path);
+
+        auto it = file.begin();
+        auto question = hexagonal_walk::read_question(it, file.end());
+
+        if (trace) {
+          trace->span("read_question.parse", parsing_time, std::chrono::steady_clock::now(), "\"name\": " + hexagonal_walk::json_string(file_path));
+        }
+
+        submit(std::move(question));
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(futures_mutex);
+      reading = false;
+    }
+
+    futures_condition_variable.notify_one();
+    writer.join();
+  }
+
+  // 問題ごとの時間（ミリ秒）と得点を、タブ区切りで出力します。以前の出力を基準として渡すと、得点の低下と時間の増加を検出します。
+  const auto benchmark(const std::vector<const char*>& file_paths, const char* baseline_path, const int& threads, const std::uint64_t& seed, const std::chrono::milliseconds& budget, const std::size_t& iteration_limit, const bool& statistics, hexagonal_walk::trace* trace) noexcept {
+    const std::vector<std::string> timing_names{
+      "read_question",
+      "stage_1.depth_first_search", "stage_1.fattening", "stage_1.beam_search", "stage_1",
+      "stage_2.fattening", "stage_2.local_search", "stage_2",
+      "stage_3.local_search", "stage_3",
+      "total"};
+
+    hexagonal_walk::thread_pool thread_pool(4);  // 問題は一つずつ解くので、探索のスレッドは全ての問題で使い回します。
+
+    const auto baseline = [&]() {
+      std::unordered_map<std::string, std::tuple<int, double>> result;
+
+      if (!baseline_path) {
+        return result;
+      }
+
+      std::ifstream stream(baseline_path);
+
+      std::string line;
+      std::getline(stream, line);  // 見出しの行です。
+
+      while (std::getline(stream, line)) {
+        std::vector<std::string> fields;
+        boost::split(fields, line, boost::is_any_of("\t"));
+
+        if (fields.size() < timing_names.size() + 3) {
+          continue;
+        }
+
+        result.emplace(fields[0], std::make_tuple(std::atoi(fields[1].c_str()), std::atof(fields[3 + timing_names.size() - 1].c_str())));
+      }
+
+      return result;
+    }();
+
+    std::cout << "name\tpoint\tlength";
+    for (const auto& timing_name : timing_names) {
+      std::cout << "\t" << timing_name;
+    }
+    std::cout << "\tregression" << std::endl;
+
+    auto regression_count = 0;
+
+    for (const auto& file_path : file_paths) {
+      const auto starting_time = std::chrono::steady_clock::now();
+
+      hexagonal_walk::timings timings(trace);
+      hexagonal_walk::counters counters;
+
+      const auto question = [&]() {
+        const hexagonal_walk::mapped_file file(file_path);
+
+        auto it = file.begin();
+        return hexagonal_walk::read_question(it, file.end());
+      }();
+
+      const auto building_time = std::chrono::steady_clock::now();
+
+      int answer_point;
+      std::size_t answer_size;
+
+      std::tie(answer_point, answer_size) = hexagonal_walk::visit_problem(
+        question,
+        [&](const auto& problem) {
+          const auto solving_time = std::chrono::steady_clock::now();
+
+          timings.record("read_question", std::chrono::duration<double, std::milli>(solving_time - starting_time).count());  // 盤面の構築までを含めます。
+
+          if (trace) {
+            trace->span("read_question.parse", starting_time, building_time, "\"name\": " + hexagonal_walk::json_string(file_path));
+            trace->span("read_question.build", building_time, solving_time);
+          }
+
+          const auto answer = problem.empty() ? std::vector<typename std::decay_t<decltype(problem)>::index_type>{} : solve(problem, threads, seed, hexagonal_walk::scheduler(starting_time, budget, iteration_limit), thread_pool, timings, counters);
+
+          return std::make_tuple(static_cast<int>(hexagonal_walk::point(problem, answer)), answer.size());
+        });
+
+      timings.record("total", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - starting_time).count());
+
+      if (trace) {
+        trace->span("solve", starting_time, std::chrono::steady_clock::now(), "\"name\": " + hexagonal_walk::json_string(file_path));
+      }
+
+      if (statistics) {
+        write_statistics(std::cerr, file_path, timings, counters);
+      }
+
+      std::cout << file_path << "\t" << answer_point << "\t" << answer_size;
+      for (const auto& timing_name : timing_names) {
+        const auto& it = timings.milliseconds().find(timing_name);
+        if (it == std::end(timings.milliseconds())) {
+          std::cout << "\t-";  // 途中で解が見つかった場合は、以降のステージは実行されません。
+          continue;
+        }
+
+        std::cout << "\t" << std::fixed << std::setprecision(1) << it->second;
+      }
+
+      std::vector<std::string> regressions;
+
+      const auto& baseline_it = baseline.find(file_path);
+      if (baseline_it != std::end(baseline)) {
+        if (answer_point < std::get<0>(baseline_it->second)) {
+          regressions.emplace_back("point");
+        }
+
+        if (timings.milliseconds().at("total") > std::get<1>(baseline_it->second) * 1.2 + 100) {  // 時間は揺らぐので、少し余裕を持たせます。
+          regressions.emplace_back("latency");
+        }
+      }
+
+      std::cout << "\t" << boost::join(regressions, ",") << std::endl;
+
+      if (!regressions.empty()) {
+        ++regression_count;
+      }
+    }
+
+    if (regression_count > 0) {
+      std::cerr << regression_count << " regression(s) against " << baseline_path << std::endl;
+    }
+
+    return regression_count == 0 ? 0 : 1;
+  }
+}
+
+int main(int argc, char** argv) {
+  const auto starting_time = std::chrono::steady_clock::now();
+
+  std::cin.tie(0);
+  std::ios::sync_with_stdio(false);
+
+  auto batch = false;
+  auto bench = false;
+  const char* baseline_path = nullptr;
+  auto jobs = std::max(static_cast<int>(std::thread::hardware_concurrency()) / 4, 1);  // 一つの問題で、最大4スレッドを使用します。
+  auto budget = std::chrono::milliseconds(5000);  // 一つの問題の制限時間です。出力のための余裕は、schedulerの締め切りの割合で残します。
+  auto threads = 0;  // 一つの問題のビーム・サーチで使用するスレッドの数です。0なら、コアの数から決めます。
+  auto seed = static_cast<std::uint64_t>(std::random_device()());  // 乱数のシードです。指定すれば、探索をやり直せます。
+  auto iteration_limit = static_cast<std::size_t>(0);  // 0でなければ、時間ではなく回数で探索を打ち切ります。--seedと合わせて指定すれば、毎回同じ解になります。
+                                                       // 回数は、探索ごとに評価する手の数です（深さ優先探索は試す手、ビーム・サーチは展開する状態、local_searchは評価する変更の数で、各探索が自分の単位に換算します）。
+  auto statistics = false;  // 問題ごとの時間とカウンターを、JSONで標準エラー出力に出力します。
+  const char* trace_path = nullptr;  // 指定されたら、スレッドごとの探索の期間と解の改善を、トレース・イベントの形式で書き出します。
+  std::vector<const char*> file_paths;
+
+  for (auto i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--batch") == 0) {
+      batch = true;
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--bench") == 0) {
+      bench = true;
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baseline_path = argv[++i];
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = std::max(std::atoi(argv[++i]), 1);
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+      budget = std::chrono::milliseconds(std::max(std::atoi(argv[++i]), 1));
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = std::max(std::atoi(argv[++i]), 1);
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--stats") == 0) {
+      statistics = true;
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+      continue;
+    }
+
+    if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iteration_limit = std::strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+
+    file_paths.emplace_back(argv[i]);
+  }
+
+  if (threads == 0) {
+    threads = std::max(static_cast<int>(std::thread::hardware_concurrency()) / (!bench && (batch || !file_paths.empty()) ? jobs : 1), 1);  // バッチでは、コアを問題の間で分け合います。
+  }
+
+  std::unique_ptr<hexagonal_walk::trace> trace(trace_path ? std::make_unique<hexagonal_walk::trace>(starting_time) : nullptr);
+
+  // std::quick_exitはデストラクタを呼ばないので、トレースはここで書き出します。
+  const auto finish = [&](const int& status) {
+    if (trace) {
+      std::ofstream stream(trace_path);
+      trace->write(stream);
+    }
+
+    std::quick_exit(status);
+  };
+
+  if (bench) {
+    finish(benchmark(file_paths, baseline_path, threads, seed, budget, iteration_limit, statistics, trace.get()));
+  }
+
+  if (batch || !file_paths.empty()) {
+    solve_batch(file_paths, jobs, threads, seed, budget, iteration_limit, statistics, trace.get());
+    finish(0);
+  }
+
+  const auto question = [&]() {
+    const hexagonal_walk::mapped_file file(STDIN_FILENO);
+
+    auto it = file.begin();
+    return hexagonal_walk::read_question(it, file.end());
+  }();
+
+  if (question.empty()) {
+    finish(0);
+  }
+
+  const auto building_time = std::chrono::steady_clock::now();
 
-    local_search_2_future.wait_until(starting_time + std::chrono::milliseconds(4600));
-    local_search_2.stop();
-    auto local_search_2_result = local_search_2_future.get();
+  hexagonal_walk::visit_problem(
+    question,
+    [&](const auto& problem) {
+      if (trace) {
+        trace->span("read_question.parse", starting_time, building_time);
+        trace->span("read_question.build", building_time, std::chrono::steady_clock::now());
+      }
 
-    local_search_3_future.wait_until(starting_time + std::chrono::milliseconds(4600));
-    local_search_3.stop();
-    auto local_search_3_result = local_search_3_future.get();
+      if (problem.empty()) {  // スタートがない盤面には、何も出力しません。
+        return;
+      }
 
-    local_search_4_future.wait_until(starting_time + std::chrono::milliseconds(4600));
-    local_search_4.stop();
-    auto local_search_4_result = local_search_4_future.get();
+      hexagonal_walk::thread_pool thread_pool(4);
+      hexagonal_walk::timings timings(trace.get());
+      hexagonal_walk::counters counters;
+      hexagonal_walk::write_answer(std::cout, problem, solve(problem, threads, seed, hexagonal_walk::scheduler(starting_time, budget, iteration_limit), thread_pool, timings, counters));
 
-    return std::max({local_search_1_result, local_search_2_result, local_search_3_result, local_search_4_result}, [](const auto& result_1, const auto& result_2) { return hexagonal_walk::point(result_1) < hexagonal_walk::point(result_2); });
-   }();
+      if (statistics) {
+        write_statistics(std::cerr, "-", timings, counters);
+      }
+    });
 
-  hexagonal_walk::write_answer(result_3);
-  std::quick_exit(0);
+  finish(0);
 
   return 0;
 }
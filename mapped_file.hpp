@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hexagonal_walk {
+  // ファイルをメモリにマップして、コピーせずに読み込みます。パイプ等でマップできない場合は、大きなブロック単位で読み込みます。
+  class mapped_file {
+    const char* _data;
+    std::size_t _size;
+    bool _mapped;
+    std::vector<char> _buffer;
+
+    void load(const int& file_descriptor) noexcept {
+      struct stat stat;
+      if (fstat(file_descriptor, &stat) == 0 && S_ISREG(stat.st_mode) && stat.st_size > 0) {
+        const auto data = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+
+        if (data != MAP_FAILED) {
+          madvise(data, stat.st_size, MADV_SEQUENTIAL);
+
+          _data = static_cast<const char*>(data);
+          _size = stat.st_size;
+          _mapped = true;
+
+          return;
+        }
+      }
+
+      constexpr std::size_t block_size = 1 << 20;
+
+      for (;;) {
+        const auto size = _buffer.size();
+        _buffer.resize(size + block_size);
+
+        const auto read_size = read(file_descriptor, _buffer.data() + size, block_size);
+        if (read_size <= 0) {
+          _buffer.resize(size);
+          break;
+        }
+
+        _buffer.resize(size + read_size);
+      }
+
+      _data = _buffer.data();
+      _size = _buffer.size();
+    }
+
+  public:
+    mapped_file(const int& file_descriptor) noexcept
+      : _data(nullptr), _size(0), _mapped(false), _buffer()
+    {
+      load(file_descriptor);
+    }
+
+    mapped_file(const char* path) noexcept
+      : _data(nullptr), _size(0), _mapped(false), _buffer()
+    {
+      const auto file_descriptor = open(path, O_RDONLY);
+      if (file_descriptor < 0) {
+        return;
+      }
+
+      load(file_descriptor);
+      close(file_descriptor);  // マップした領域は、閉じた後も有効です。
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+      if (_mapped) {
+        munmap(const_cast<char*>(_data), _size);
+      }
+    }
+
+    const auto begin() const noexcept {
+      return _data;
+    }
+
+    const auto end() const noexcept {
+      return _data + _size;
+    }
+  };
+}
@@ -0,0 +1,80 @@
+﻿#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace hexagonal_walk {
+  // シードを広げるための、SplitMix64です。連続したシードからでも、ばらけた値を作れます。
+  inline auto splitmix64(std::uint64_t& state) noexcept {
+    auto result = (state += 0x9e3779b97f4a7c15ull);
+
+    result = (result ^ (result >> 30)) * 0xbf58476d1ce4e5b9ull;
+    result = (result ^ (result >> 27)) * 0x94d049bb133111ebull;
+
+    return result ^ (result >> 31);
+  }
+
+  // xoshiro256**です。std::default_random_engineより速くて質も良く、状態は32バイトで済むので、スレッドごとに持たせます。
+  class xoshiro256 {
+    std::array<std::uint64_t, 4> _state;
+
+    static auto rotl(const std::uint64_t& x, const int& k) noexcept {
+      return (x << k) | (x >> (64 - k));
+    }
+
+  public:
+    using result_type = std::uint64_t;
+
+    explicit xoshiro256(std::uint64_t seed) noexcept
+      : _state()
+    {
+      for (auto& state : _state) {
+        state = splitmix64(seed);
+      }
+    }
+
+    static constexpr result_type min() noexcept {
+      return 0;
+    }
+
+    static constexpr result_type max() noexcept {
+      return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() noexcept {
+      const auto result = rotl(_state[1] * 5, 7) * 9;
+      const auto t = _state[1] << 17;
+
+      _state[2] ^= _state[0];
+      _state[3] ^= _state[1];
+      _state[1] ^= _state[2];
+      _state[0] ^= _state[3];
+
+      _state[2] ^= t;
+      _state[3] = rotl(_state[3], 45);
+
+      return result;
+    }
+
+    // [0, size)の一様な整数です。剰余を取ると小さい値に偏るので、Lemireの方法（掛け算と、まれな棄却）を使います。
+    std::uint32_t bounded(const std::uint32_t& size) noexcept {
+      auto m = ((*this)() >> 32) * size;
+
+      if (static_cast<std::uint32_t>(m) < size) {
+        const auto threshold = static_cast<std::uint32_t>(-size) % size;
+
+        while (static_cast<std::uint32_t>(m) < threshold) {
+          m = ((*this)() >> 32) * size;
+        }
+      }
+
+      return static_cast<std::uint32_t>(m >> 32);
+    }
+
+    // [0, 1)の一様な実数です。
+    double uniform() noexcept {
+      return ((*this)() >> 11) * (1.0 / (static_cast<std::uint64_t>(1) << 53));
+    }
+  };
+}
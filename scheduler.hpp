@@ -0,0 +1,175 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace hexagonal_walk {
+  // 探索の進み具合です。探索は、解が改善するたびにimprove()を呼び出します。スケジューラーは、改善の頻度を見て時間を配分します。
+  class progress {
+    std::atomic<std::int64_t> _starting_time;  // steady_clockのエポックからのナノ秒です。
+    std::atomic<std::int64_t> _improved_time;
+    std::atomic<int> _improvement_count;
+
+    static auto now() noexcept {
+      return static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+  public:
+    progress() noexcept
+      : _starting_time(now()), _improved_time(now()), _improvement_count(0)
+    {
+      ;
+    }
+
+    void start() noexcept {
+      _starting_time = now();
+      _improved_time = now();
+      _improvement_count = 0;
+    }
+
+    void improve() noexcept {
+      _improved_time = now();
+      ++_improvement_count;
+    }
+
+    // 最後の改善からの経過時間がwindowか、これまでの平均の改善間隔の2倍を超えていなければ、まだ改善中とみなします。
+    const auto improving(const std::chrono::nanoseconds& window) const noexcept {
+      const auto improved_time = _improved_time.load();
+      const auto improvement_count = _improvement_count.load();
+
+      const auto interval = improvement_count == 0 ? 0 : (improved_time - _starting_time.load()) / improvement_count;
+
+      return now() - improved_time < std::max<std::int64_t>(window.count(), interval * 2);
+    }
+  };
+
+  // 全体の制限時間を、各ステージに割り合てます。締め切りは制限時間に対する割合で指定するので、5秒より短い制限時間にも長い制限時間にも対応できます。
+  // iteration_limitを指定した場合は、締め切りを無視して、探索が回数の上限で終わるのを待ちます。時間に左右されないので、同じシードなら同じ解になります。
+  class scheduler {
+    std::chrono::steady_clock::time_point _starting_time;
+    std::chrono::milliseconds _budget;
+    std::size_t _iteration_limit;  // 0なら、時間で打ち切ります。
+
+    auto reserve() const noexcept {
+      return std::min(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(25)), std::chrono::duration_cast<std::chrono::steady_clock::duration>(_budget) / 2);
+    }
+
+    // solverが終わるか、打ち切る条件を満たすまで待ちます。solverが終わったか、改善が止まったので打ち切る場合（他のsolverには関係ない場合）はtrueを返します。
+    template <typename T, typename Solver>
+    auto watch(std::future<T>& future, Solver& solver, const std::chrono::steady_clock::time_point& deadline, const std::chrono::steady_clock::time_point& extended_deadline, const bool& stop_if_stalled, const std::function<bool()>& finished) const noexcept {
+      const auto window = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(_budget) / 50, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(1)));
+
+      while (future.wait_until(std::min(std::chrono::steady_clock::now() + window / 4, extended_deadline)) != std::future_status::ready) {
+        const auto now = std::chrono::steady_clock::now();
+
+        if (now >= extended_deadline) {
+          return false;
+        }
+
+        if (finished && finished()) {
+          return false;
+        }
+
+        if (now >= deadline && !solver.progress().improving(window)) {
+          return false;
+        }
+
+        if (stop_if_stalled && !solver.progress().improving(window)) {
+          return true;
+        }
+      }
+
+      return true;
+    }
+
+  public:
+    scheduler(const std::chrono::steady_clock::time_point& starting_time, const std::chrono::milliseconds& budget, const std::size_t& iteration_limit = 0) noexcept
+      : _starting_time(starting_time), _budget(budget), _iteration_limit(iteration_limit)
+    {
+      ;
+    }
+
+    const auto& iteration_limit() const noexcept {
+      return _iteration_limit;
+    }
+
+    // 締め切りは、延長も含めて制限時間を超えないようにします。止めた探索が実際に止まって解答を出力するまでにも時間がかかるので（コアが少ないと、他のスレッドの順番を待つ分も）、その分を最後に残します。
+    // 残す時間は固定なので、制限時間が短いと、後のステージの締め切りはすべて同じ時刻になります。
+    const auto deadline(const double& ratio) const noexcept {
+      return _starting_time + std::min(std::chrono::duration_cast<std::chrono::steady_clock::duration>(_budget * ratio), std::chrono::duration_cast<std::chrono::steady_clock::duration>(_budget) - reserve());
+    }
+
+    // ratioの締め切りまでに、ステージを始めるだけの時間が残っていないかです。大きな盤面では探索の準備だけでも数ミリ秒かかるので、残りが少ないなら始めても制限時間を超えるだけです。回数で打ち切る場合は、時間を見ません。
+    const auto expired(const double& ratio) const noexcept {
+      return !_iteration_limit && std::chrono::steady_clock::now() + reserve() / 2 >= deadline(ratio);
+    }
+
+    // solverの終了を、deadlineまで待ちます。deadlineを過ぎてもsolverの解が改善し続けているなら、extended_deadlineまでは待ちます（後のステージの時間を借ります）。
+    // stop_if_stalledなら、改善が止まった時点でdeadlineより前でも打ち切ります（後のステージに時間を譲ります）。finishedがtrueを返したら（最適解が見つかったら）、すぐに打ち切ります。
+    template <typename T, typename Solver>
+    auto wait(std::future<T>& future, Solver& solver, const std::chrono::steady_clock::time_point& deadline, const std::chrono::steady_clock::time_point& extended_deadline, const bool& stop_if_stalled = false, const std::function<bool()>& finished = nullptr) const noexcept {
+      if (_iteration_limit) {
+        return future.get();
+      }
+
+      watch(future, solver, deadline, extended_deadline, stop_if_stalled, finished);
+
+      solver.stop();
+
+      return future.get();
+    }
+
+    // 並行して動いている複数のsolverの終了を、上と同じ条件で順に待ちます。締め切りか最適解で打ち切る場合は、まだ待っていないsolverもまとめて止めます。
+    // 1つずつ止めると、止めたsolverが抜けるのを待つ間も残りのsolverがCPUを使い続けるので（コアが少ないと特に）、制限時間を超えてしまうためです。
+    template <typename T, typename Solver>
+    auto wait(std::vector<std::future<T>>& futures, const std::vector<std::unique_ptr<Solver>>& solvers, const std::chrono::steady_clock::time_point& deadline, const std::chrono::steady_clock::time_point& extended_deadline, const bool& stop_if_stalled = false, const std::function<bool()>& finished = nullptr) const noexcept {
+      std::vector<T> results;
+
+      for (auto i = static_cast<std::size_t>(0); i < futures.size(); ++i) {
+        if (_iteration_limit) {
+          results.emplace_back(futures[i].get());
+          continue;
+        }
+
+        if (!watch(futures[i], *solvers[i], deadline, extended_deadline, stop_if_stalled, finished)) {
+          for (auto j = i; j < solvers.size(); ++j) {
+            solvers[j]->stop();
+          }
+        }
+
+        solvers[i]->stop();
+
+        results.emplace_back(futures[i].get());
+      }
+
+      return results;
+    }
+
+    // solverの終了を、deadlineまで待ちます。改善の具合は見ません。
+    template <typename T, typename Solver>
+    auto wait(std::future<T>& future, Solver& solver, const std::chrono::steady_clock::time_point& deadline, const std::function<bool()>& finished = nullptr) const noexcept {
+      if (_iteration_limit) {
+        return future.get();
+      }
+
+      const auto window = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(_budget) / 50, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(1)));
+
+      while (future.wait_until(std::min(std::chrono::steady_clock::now() + window / 4, deadline)) != std::future_status::ready) {
+        if (std::chrono::steady_clock::now() >= deadline || (finished && finished())) {
+          break;
+        }
+      }
+
+      solver.stop();
+
+      return future.get();
+    }
+  };
+}
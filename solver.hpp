@@ -1,11 +1,14 @@
 ﻿#pragma once
 
+#include <array>
 #include <atomic>
+#include <cmath>
 #include <cstdint>
-#include <queue>
+#include <future>
+#include <limits>
 #include <random>
+#include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include <boost/container/static_vector.hpp>
@@ -17,184 +20,500 @@
 #include <boost/range/iterator_range.hpp>
 #include <boost/range/numeric.hpp>
 
+#include "bitboard.hpp"
+#include "counters.hpp"
 #include "game.hpp"
+#include "incumbent.hpp"
+#include "random.hpp"
+#include "scheduler.hpp"
+#include "thread_pool.hpp"
+#include "transposition_table.hpp"
 
 namespace hexagonal_walk {
+  template <typename Problem>
   class beam_search {
-    std::atomic<bool> _stop;
-    std::unordered_set<std::size_t> _searched_hashes;  // ハッシュ値そのものをキーにしているので、たまたまハッシュが一致して正解を逃す危険性があります。……が、気にしません。
+    using index_type = typename Problem::index_type;
+
+    // 全ての状態の経路を、親の添字を持つ木で共有します。これで、子の状態を作るたびに経路やビット・セットをコピーしなくて済みます。
+    class path_tree {
+      static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+      std::vector<std::uint32_t> _parents;
+      std::vector<std::uint32_t> _depths;
+      std::vector<index_type> _indice;
+
+    public:
+      path_tree(const Problem& problem) noexcept
+        : _parents(), _depths(), _indice()
+      {
+        _parents.reserve(1 << 16);
+        _depths.reserve(1 << 16);
+        _indice.reserve(1 << 16);
+
+        _parents.emplace_back(none);
+        _depths.emplace_back(0);
+        _indice.emplace_back(problem.start_index());
+      }
+
+      const auto add(const std::uint32_t& parent, const index_type& index) noexcept {
+        _parents.emplace_back(parent);
+        _depths.emplace_back(_depths[parent] + 1);
+        _indice.emplace_back(index);
+
+        return static_cast<std::uint32_t>(_indice.size() - 1);
+      }
+
+      const auto& index(const std::uint32_t& node) const noexcept {
+        return _indice[node];
+      }
+
+      const auto& parent(const std::uint32_t& node) const noexcept {
+        return _parents[node];
+      }
+
+      const auto& depth(const std::uint32_t& node) const noexcept {
+        return _depths[node];
+      }
+
+      const auto size() const noexcept {
+        return _indice.size();
+      }
+
+      const auto path(std::uint32_t node) const noexcept {
+        std::vector<index_type> result; result.reserve(_depths[node] + 1);
+
+        for (; node != none; node = _parents[node]) {
+          result.emplace_back(_indice[node]);
+        }
+        boost::reverse(result);
+
+        return result;
+      }
+
+      // nodesから辿れない節を削除して、木を詰め直します。添字が変わるので、nodesも書き換えます。
+      void compact(std::vector<std::uint32_t>& nodes) noexcept {
+        std::vector<std::uint32_t> new_nodes(_indice.size(), none);
+        for (auto node : nodes) {
+          for (; node != none && new_nodes[node] == none; node = _parents[node]) {
+            new_nodes[node] = 0;
+          }
+        }
+
+        // 親の添字は必ず子より小さいので、前から詰めれば親の新しい添字は確定済みです。
+        auto size = 0;
+        for (auto i = 0; i < static_cast<int>(_indice.size()); ++i) {
+          if (new_nodes[i] == none) {
+            continue;
+          }
+
+          new_nodes[i] = size;
+          _parents[size] = _parents[i] == none ? none : new_nodes[_parents[i]];
+          _depths[size] = _depths[i];
+          _indice[size] = _indice[i];
+          ++size;
+        }
+
+        _parents.resize(size);
+        _depths.resize(size);
+        _indice.resize(size);
+
+        for (auto& node : nodes) {
+          node = new_nodes[node];
+        }
+      }
+    };
+
+    // 木の中の一つの経路と、その経路上のタイルです。スレッドごとに持ちます。
+    class path_cursor {
+      const path_tree& _path_tree;
+      std::vector<std::uint8_t> _visited;  // スタートは、ゴールするまで含めません。
+      std::uint32_t _current;
+
+    public:
+      path_cursor(const Problem& problem, const path_tree& path_tree) noexcept
+        : _path_tree(path_tree), _visited(problem.tiles().size(), false), _current(0)
+      {
+        ;
+      }
+
+      // nodeの経路に切り替えます。共通の祖先までを辿るだけなので、同じような経路の間の切り替えは安価です。
+      void visit(const std::uint32_t& node) noexcept {
+        std::vector<index_type> indice;
+
+        for (auto ancestor = node; _current != ancestor; ) {
+          if (_path_tree.depth(_current) >= _path_tree.depth(ancestor)) {
+            _visited[_path_tree.index(_current)] = false;
+            _current = _path_tree.parent(_current);
+            continue;
+          }
+
+          indice.emplace_back(_path_tree.index(ancestor));
+          ancestor = _path_tree.parent(ancestor);
+        }
+
+        for (const auto& index : indice) {
+          _visited[index] = true;
+        }
+
+        _current = node;
+      }
+
+      const auto visited(const index_type& index) const noexcept {
+        return static_cast<bool>(_visited[index]);
+      }
+    };
 
     class game_state {
-      std::vector<std::uint16_t> _indice;
-      boost::dynamic_bitset<> _indice_bitset;
+      std::uint32_t _node;
+      index_type _index;
       std::uint16_t _point_capacity;
-      float _score;
+      int _point;
+      int _score;  // 浮動小数点数だと、足す順番で丸めが変わって同点の順位が揺れるので、60倍した整数で持ちます（周囲のタイルの数は1〜6なので、割り切れます）。
+      std::uint64_t _hash;
 
     public:
-      game_state(std::vector<std::uint16_t>&& indice, boost::dynamic_bitset<>&& indice_bitset, const std::uint16_t& point_capacity, const float& score) noexcept
-        : _indice(indice), _indice_bitset(indice_bitset), _point_capacity(point_capacity), _score(score)
+      game_state(const std::uint32_t& node, const index_type& index, const std::uint16_t& point_capacity, const int& point, const int& score, const std::uint64_t& hash) noexcept
+        : _node(node), _index(index), _point_capacity(point_capacity), _point(point), _score(score), _hash(hash)
       {
         ;
       }
 
-      const auto& indice() const noexcept {
-        return _indice;
+      const auto& node() const noexcept {
+        return _node;
       }
 
-      const auto& indice_bitset() const noexcept {
-        return _indice_bitset;
+      auto& node() noexcept {
+        return _node;
+      }
+
+      const auto& index() const noexcept {
+        return _index;
       }
 
       const auto& point_capacity() const noexcept {
         return _point_capacity;
       }
 
-      const auto is_goaled() const noexcept {
-        return _indice_bitset[_start_index];
+      const auto& point() const noexcept {
+        return _point;
+      }
+
+      const auto& score() const noexcept {
+        return _score;
+      }
+
+      const auto& hash() const noexcept {
+        return _hash;
       }
 
+      // スコアが同じなら、ポイントが大きい方を優先します。
       const auto operator<(const game_state& other) const noexcept {
-        return _score < other._score;
+        return std::tie(_score, _point) < std::tie(other._score, other._point);
       }
     };
 
-    const auto maybe_returnable(const game_state& game_state, const std::uint16_t& next_index) const noexcept {
-      std::priority_queue<std::tuple<std::uint16_t, std::uint16_t>> queue;
-      queue.emplace(UINT16_MAX - _distances[next_index], next_index);  // priority_queueは、大きい順です。だから、UINT16_MAXから距離を引いて、ゴールに近い順に処理します。
-
-      boost::dynamic_bitset<> indice_bitset(game_state.indice_bitset());
-      indice_bitset[next_index] = true;
+    // スコアが高い順に、size個だけ残します。
+    static void select(std::vector<game_state>& game_states, const std::size_t& size) noexcept {
+      const auto result_size = std::min(game_states.size(), size);
 
-      int size = 0;
-      while (!queue.empty() && ++size <= 200) {  // どうせ長い手は解けないので、一定の数で探索を諦めます。
-        const auto index = std::get<1>(queue.top()); queue.pop();
+      std::partial_sort(std::begin(game_states), std::begin(game_states) + result_size, std::end(game_states), [](const auto& game_state_1, const auto& game_state_2) { return game_state_2 < game_state_1; });
+      game_states.erase(std::begin(game_states) + result_size, std::end(game_states));
+    }
 
-        if (index == _start_index) {
+    // 一つのスレッドで、層の一部の状態を展開します。
+    class worker {
+      beam_search& _beam_search;
+      path_cursor _path_cursor;
+      std::vector<std::uint32_t> _stamps;
+      std::uint32_t _epoch;
+      std::vector<std::vector<index_type>> _buckets;
+
+      // 数は手元で数えておいて、担当分を展開し終えたらbeam_searchのカウンターに足し込みます。
+      std::uint64_t _generated_count;
+      std::uint64_t _returnable_search_count;
+      std::uint64_t _returnable_search_cap_count;
+
+      const auto maybe_returnable(const index_type& next_index) noexcept {
+        const auto& problem = _beam_search._problem;
+        const auto& adjacency = problem.adjacencies()[next_index];
+
+        // 探索するまでもない場合を、先に片付けます。スタートかその隣ならそのまま戻れますし、周囲が全て訪問済みなら行き止まりです。
+        if (next_index == problem.start_index() || boost::find(adjacency, problem.start_index()) != std::end(adjacency)) {
           return true;
         }
 
-        for (const auto& adjacency_index : _adjacencies[index]) {
-          if (indice_bitset[adjacency_index]) {
-            continue;
-          }
-          indice_bitset[adjacency_index] = true;
+        if (boost::count_if(adjacency, [&](const auto& adjacency_index) { return !_path_cursor.visited(adjacency_index); }) == 0) {
+          return false;
+        }
 
-          queue.emplace(UINT16_MAX - _distances[adjacency_index], adjacency_index);
+        if (++_epoch == 0) {
+          boost::fill(_stamps, 0);
+          _epoch = 1;
         }
-      }
 
-      return false;
-    }
+        ++_returnable_search_count;
 
-    const auto score(const std::vector<std::uint16_t>& indice, const boost::dynamic_bitset<>& indice_bitset) const noexcept {
-      return
-        boost::accumulate(
-          indice |
-          boost::adaptors::transformed(
-            [&](const auto& index) {
-              return static_cast<float>(6 - _adjacencies[index].size()) / 6;  // 周囲のタイルの数が少ないところ（＝端）を攻めます。
-            }),
-          0.0f) +
-        boost::accumulate(
-          indice |
-          boost::adaptors::transformed(
-            [&](const auto& index) {
-              return
-                static_cast<float>(boost::count_if(  // 周囲の探索済みタイルの数。
-                                     _adjacencies[index],
-                                     [&](const auto& adjacency_index) {
-                                       return indice_bitset[adjacency_index];
-                                     })) /
-                _adjacencies[index].size();          // 周囲のタイルの数。
-            }),
-          0.0f);
-    }
+        // 距離は小さな整数なので、優先度付きキューの代わりに距離ごとのバケツを使います。バケツは使い回すので、メモリの確保は最初だけです。
+        auto minimum_distance = static_cast<std::size_t>(adjacency.distance());
+        auto maximum_distance = minimum_distance;
 
-    const auto next_game_states(const game_state& game_state) noexcept {
-      std::vector<beam_search::game_state> result; result.reserve(6);
+        _buckets[minimum_distance].emplace_back(next_index);
+        _stamps[next_index] = _epoch;
 
-      std::size_t indice_bitset_hash = 0;
-      boost::hash_combine(indice_bitset_hash, boost::hash_value(game_state.indice_bitset().m_bits));
+        auto result = false;
 
-      for (const auto& next_index : _adjacencies[game_state.indice().back()]) {
-        if (game_state.indice_bitset()[next_index]) {
-          continue;
+        int size = 0;
+        while (++size <= 200) {  // どうせ長い手は解けないので、一定の数で探索を諦めます。
+          while (minimum_distance <= maximum_distance && _buckets[minimum_distance].empty()) {
+            ++minimum_distance;
+          }
+
+          if (minimum_distance > maximum_distance) {
+            break;
+          }
+
+          const auto index = _buckets[minimum_distance].back(); _buckets[minimum_distance].pop_back();
+
+          if (index == problem.start_index()) {
+            result = true;
+            break;
+          }
+
+          for (const auto& adjacency_index : problem.adjacencies()[index]) {
+            if (_path_cursor.visited(adjacency_index) || _stamps[adjacency_index] == _epoch) {
+              continue;
+            }
+            _stamps[adjacency_index] = _epoch;
+
+            const auto distance = static_cast<std::size_t>(problem.adjacencies()[adjacency_index].distance());
+
+            _buckets[distance].emplace_back(adjacency_index);
+            minimum_distance = std::min(minimum_distance, distance);
+            maximum_distance = std::max(maximum_distance, distance);
+          }
         }
 
-        const auto next_index_point = _points[next_index];
+        for (auto distance = minimum_distance; distance <= maximum_distance; ++distance) {
+          _buckets[distance].clear();
+        }
 
-        if (next_index_point > game_state.point_capacity()) {
-          continue;
+        if (size > 200) {
+          ++_returnable_search_cap_count;
         }
 
-        std::size_t hash = indice_bitset_hash;
-        boost::hash_combine(hash, std::hash<std::uint16_t>()(next_index));
+        return result;
+      }
 
-        if (!_searched_hashes.emplace(hash).second) {
-          continue;
+      // _path_cursorの経路にnext_indexを追加したときの、スコアの増分です。
+      // スコアは、経路上の各タイルの「端である度合い」と「周囲の探索済みタイルの割合」の合計です。next_indexを追加して変わるのは、next_index自身の項と、経路上にある隣のタイルの割合だけです。
+      const auto score_delta(const index_type& next_index) const noexcept {
+        const auto& problem = _beam_search._problem;
+        const auto& adjacency = problem.adjacencies()[next_index];
+
+        auto visited_size = 0;
+        auto result = static_cast<int>(6 - adjacency.size()) * 60 / 6;  // 周囲のタイルの数が少ないところ（＝端）を攻めます。
+
+        for (const auto& adjacency_index : adjacency) {
+          if (_path_cursor.visited(adjacency_index)) {
+            ++visited_size;
+          }
+
+          if (_path_cursor.visited(adjacency_index) || adjacency_index == problem.start_index()) {  // スタートは、ゴールするまで訪問済みにはなりませんけど、経路の上にはあります。
+            result += 60 / static_cast<int>(problem.adjacencies()[adjacency_index].size());
+          }
         }
 
-        if (!maybe_returnable(game_state, next_index)) {
-          continue;
+        return result + visited_size * 60 / static_cast<int>(adjacency.size());
+      }
+
+      void next_game_states(const game_state& game_state, std::vector<beam_search::game_state>& result) noexcept {
+        const auto& problem = _beam_search._problem;
+
+        _path_cursor.visit(game_state.node());
+
+        for (const auto& next_index : problem.adjacencies()[game_state.index()]) {
+          if (_path_cursor.visited(next_index)) {
+            continue;
+          }
+
+          const auto next_index_point = problem.adjacencies()[next_index].point();
+
+          if (next_index_point > game_state.point_capacity()) {
+            continue;
+          }
+
+          const auto hash = game_state.hash() ^ _beam_search._zobrist_keys[next_index];
+
+          if (!_beam_search._searched_hashes.insert(hash ^ _beam_search._head_zobrist_keys[next_index])) {
+            continue;
+          }
+
+          if (!maybe_returnable(next_index)) {
+            continue;
+          }
+
+          ++_generated_count;
+
+          result.emplace_back(
+            game_state.node(),  // 木に追加するまでは、親の節を指しておきます。
+            next_index,
+            std::max<std::uint16_t>(game_state.point_capacity(), next_index_point + 1),
+            game_state.point() + next_index_point,
+            game_state.score() + score_delta(next_index),
+            hash);
+        }
+      }
+
+    public:
+      worker(beam_search& beam_search) noexcept
+        : _beam_search(beam_search), _path_cursor(beam_search._problem, beam_search._path_tree), _stamps(beam_search._problem.tiles().size(), 0), _epoch(0), _buckets(), _generated_count(0), _returnable_search_count(0), _returnable_search_cap_count(0)
+      {
+        _buckets.resize(boost::max_element(beam_search._problem.adjacencies(), [](const auto& adjacency_1, const auto& adjacency_2) { return adjacency_1.distance() < adjacency_2.distance(); })->distance() + 1);
+      }
+
+      template <typename Range>
+      const auto operator()(const Range& game_states) noexcept {
+        std::vector<game_state> result;
+
+        for (const auto& game_state : game_states) {
+          next_game_states(game_state, result);
         }
 
-        std::vector<std::uint16_t> next_indice; next_indice.reserve(game_state.indice().size() + 1);
-        next_indice = game_state.indice();
-        next_indice.emplace_back(next_index);
+        _beam_search._expanded_count.add(boost::size(game_states));
+        _beam_search._generated_count.add(_generated_count);
+        _beam_search._returnable_search_count.add(_returnable_search_count);
+        _beam_search._returnable_search_cap_count.add(_returnable_search_cap_count);
+        _generated_count = _returnable_search_count = _returnable_search_cap_count = 0;
 
-        boost::dynamic_bitset<> next_indice_bitset(game_state.indice_bitset());
-        next_indice_bitset[next_index] = true;
+        select(result, _beam_search._width);
 
-        result.emplace_back(
-          std::move(next_indice),
-          std::move(next_indice_bitset),
-          std::max<std::uint16_t>(game_state.point_capacity(), next_index_point + 1),
-          score(next_indice, next_indice_bitset));
+        return result;
       }
 
-      return result;
-    }
+      // 木を詰め直すと節の添字が変わるので、その前に根に戻しておきます。
+      void reset() noexcept {
+        _path_cursor.visit(0);
+      }
+    };
+
+    const Problem& _problem;
+    std::atomic<bool> _stop;
+    hexagonal_walk::progress _progress;
+    hexagonal_walk::incumbent<index_type>* _incumbent;  // 解が見つかったら、他の探索にも知らせます。
+    transposition_table _searched_hashes;  // ハッシュ値そのものをキーにしているので、たまたまハッシュが一致して正解を逃す危険性があります。……が、気にしません。
+
+    path_tree _path_tree;
+    std::vector<std::uint64_t> _zobrist_keys;       // 訪問済みタイルの集合のハッシュ値を、XORで差分計算するための乱数です。
+    std::vector<std::uint64_t> _head_zobrist_keys;  // 同じ集合でも、今いるタイルが違えば別の状態です。
+
+    std::size_t _width;
+    std::size_t _iteration_limit;  // 層の数の上限です。
+    std::vector<worker> _workers;
+
+    counter _layer_count;
+    counter _expanded_count;               // 展開した状態の数です。
+    counter _generated_count;              // 重複と行き止まりを除いて、生成した状態の数です。
+    counter _returnable_search_count;      // スタートに戻れるかを、探索して調べた回数です。
+    counter _returnable_search_cap_count;  // そのうち、上限に達して諦めた回数です。
+    thread_pool _thread_pool;  // 先頭のworkerは、呼び出し元のスレッドで動かします。
 
   public:
-    beam_search() noexcept
-      : _stop(false), _searched_hashes(100000)
+    beam_search(const Problem& problem, const int& threads = 1, hexagonal_walk::incumbent<index_type>* incumbent = nullptr) noexcept
+      : _problem(problem), _stop(false), _progress(), _incumbent(incumbent), _searched_hashes(300 * std::max(threads, 1) * 6 * 4, transposition_table::replacement_policy::older), _path_tree(problem), _zobrist_keys(problem.tiles().size()), _head_zobrist_keys(problem.tiles().size()), _width(300 * std::max(threads, 1)), _iteration_limit(std::numeric_limits<std::size_t>::max()), _workers(), _layer_count(), _expanded_count(), _generated_count(), _returnable_search_count(), _returnable_search_cap_count(), _thread_pool(std::max(threads, 1) - 1)
     {
-      ;
+      xoshiro256 rand(0);
+
+      boost::generate(_zobrist_keys, [&]() { return rand(); });
+      boost::generate(_head_zobrist_keys, [&]() { return rand(); });
+
+      _workers.reserve(std::max(threads, 1));
+      for (auto i = 0; i < std::max(threads, 1); ++i) {
+        _workers.emplace_back(*this);
+      }
     }
 
     const auto operator()() noexcept {
-      std::vector<std::uint16_t> result;
+      std::vector<index_type> result;
       int result_point = 0;
 
-      std::priority_queue<game_state> queue;
-      queue.emplace(std::vector<std::uint16_t>{_start_index}, boost::dynamic_bitset<>(_tiles.size()), 1, 0.0f);
+      _progress.start();
+
+      std::vector<game_state> game_states{game_state(0, _problem.start_index(), 1, 0, 0, 0)};
+      auto compaction_size = static_cast<std::size_t>(1 << 16);
 
-      while (!queue.empty() && !_stop) {
-        std::priority_queue<game_state> next_queue;
+      for (auto iteration = static_cast<std::size_t>(0); !game_states.empty() && !_stop && iteration < _iteration_limit; ++iteration) {
+        std::vector<game_state> expanding_game_states; expanding_game_states.reserve(game_states.size());
 
-        for (auto i = 0; i < 300 && !queue.empty(); ++i) {
-          const auto& game_state = queue.top(); // queue.pop();
+        for (const auto& game_state : game_states) {
+          if (game_state.index() == _problem.start_index() && game_state.node() != 0) {  // スタートに戻ってきたらゴールです。
+            if (game_state.point() > result_point) {
+              result = _path_tree.path(game_state.node());
+              result_point = game_state.point();
 
-          if (game_state.is_goaled()) {
-            const auto game_state_point = point(game_state.indice());
+              _progress.improve();
 
-            if (game_state_point > result_point) {
-              result = std::move(game_state.indice());
-              result_point = game_state_point;
+              if (_incumbent) {
+                _incumbent->publish(result, result_point);
+              }
             }
 
-            goto cont; // continue;
+            continue;
           }
 
-          for (const auto& next_game_state : next_game_states(game_state)) {
-            next_queue.emplace(std::move(next_game_state));
-          }
+          expanding_game_states.emplace_back(game_state);
+        }
+
+        // 状態をスレッドの数に分けて展開します。それぞれのスレッドで上位_width個に絞ってから、全体の上位_width個を選びます。
+        const auto chunk_size = (expanding_game_states.size() + _workers.size() - 1) / _workers.size();
+        const auto chunk = [&](const std::size_t& i) {
+          return boost::make_iterator_range(
+            std::begin(expanding_game_states) + std::min(chunk_size * i, expanding_game_states.size()),
+            std::begin(expanding_game_states) + std::min(chunk_size * (i + 1), expanding_game_states.size()));
+        };
+
+        std::vector<std::future<std::vector<game_state>>> futures;
+        for (auto i = static_cast<std::size_t>(1); i < _workers.size(); ++i) {
+          futures.emplace_back(_thread_pool.submit([&, i]() { return _workers[i](chunk(i)); }));
+        }
 
-        cont:
-          queue.pop();
+        auto next_layer = _workers[0](chunk(0));
+        for (auto& future : futures) {
+          boost::push_back(next_layer, future.get());
         }
 
-        queue = std::move(next_queue);
+        select(next_layer, _width);
+
+        _layer_count.add(1);
+
+        // 訪問済みタイルの数が違えば同じ状態にはならないので、前の層のハッシュ値は上書きしてしまって構いません。
+        _searched_hashes.next_generation();
+
+        // 生き残った状態だけを、木に追加します。
+        for (auto& game_state : next_layer) {
+          game_state.node() = _path_tree.add(game_state.node(), game_state.index());
+        }
+
+        game_states = std::move(next_layer);
+
+        // 捨てた状態の経路で木が大きくなりすぎたら、詰め直します。
+        if (_path_tree.size() > compaction_size) {
+          for (auto& worker : _workers) {
+            worker.reset();
+          }
+
+          std::vector<std::uint32_t> nodes; nodes.reserve(game_states.size());
+          for (const auto& game_state : game_states) {
+            nodes.emplace_back(game_state.node());
+          }
+
+          _path_tree.compact(nodes);
+
+          for (auto i = 0; i < static_cast<int>(game_states.size()); ++i) {
+            game_states[i].node() = nodes[i];
+          }
+
+          compaction_size = std::max<std::size_t>(_path_tree.size() * 2, 1 << 16);
+        }
       }
 
       return result;
@@ -203,48 +522,90 @@ namespace hexagonal_walk {
     const auto stop() noexcept {
       _stop = true;
     }
-  };
 
-  class local_search {
-    std::atomic<bool> _stop;
+    // 時間ではなく回数で探索を打ち切ります。同じシードなら、同じ解になります。
+    // iteration_limitは、他の探索と揃えて評価する手の数です。1層で最大_width個の状態を展開するので、層の数に換算します。
+    const auto limit_iterations(const std::size_t& iteration_limit) noexcept {
+      _iteration_limit = std::max<std::size_t>(iteration_limit / _width, 1);
+    }
 
-    const auto node(const std::vector<std::uint16_t>& indice) const noexcept {
-      std::vector<std::uint16_t> node(_tiles.size());
+    const auto& progress() const noexcept {
+      return _progress;
+    }
 
-      std::random_device random_device;
-      std::default_random_engine rand(random_device());
+    const auto& searched_hashes() const noexcept {
+      return _searched_hashes;
+    }
 
-      std::unordered_map<std::uint16_t, std::uint16_t> indice_map(indice.size());
+    // カウンターの値を、nameを前置した名前でcountersに足し込みます。
+    const auto report(counters& counters, const std::string& name) const noexcept {
+      counters.add(name + ".layers", _layer_count.value());
+      counters.add(name + ".expanded_states", _expanded_count.value());
+      counters.add(name + ".generated_states", _generated_count.value());
+      counters.add(name + ".returnable_searches", _returnable_search_count.value());
+      counters.add(name + ".returnable_search_caps", _returnable_search_cap_count.value());
+      counters.add(name + ".searched_hashes.hits", _searched_hashes.hit_count());
+      counters.add(name + ".searched_hashes.collisions", _searched_hashes.collision_count());
+      counters.add(name + ".searched_hashes.drops", _searched_hashes.drop_count());
+    }
+  };
+
+  template <typename Problem>
+  constexpr std::uint32_t beam_search<Problem>::path_tree::none;
+
+  template <typename Problem>
+  class local_search {
+    using index_type = typename Problem::index_type;
+
+    const Problem& _problem;
+    std::atomic<bool> _stop;
+    hexagonal_walk::progress _progress;
+    hexagonal_walk::incumbent<index_type>* _incumbent;  // 改善したら知らせて、他の探索の方が良い解を見つけていたら、そこからやり直します。
+    int _replica_size;                                  // 2以上なら、山登りの代わりにレプリカ交換法で探索します。
+    int _replica_threads;                               // レプリカを動かすスレッドの数です。レプリカより少なければ、1つのスレッドで複数のレプリカを順に動かします。
+    xoshiro256 _rand;
+    std::size_t _iteration_limit;                       // 山登りで評価する手の数か、レプリカ交換の回数の上限です。
+    thread_pool _thread_pool;                           // 先頭のスレッドの分は、呼び出し元のスレッドで動かします。
+
+    counter _evaluation_count;    // 評価した変更の数です。
+    counter _move_count;          // 採用した変更の数です。
+    counter _restart_count;       // 共有の解からやり直した回数です。
+    counter _replica_swap_count;  // レプリカの温度を交換した回数です。
+
+    const auto node(const std::vector<index_type>& indice) noexcept {
+      std::vector<index_type> node(_problem.tiles().size());
+
+      std::unordered_map<index_type, index_type> indice_map(indice.size());
       for (auto i = 0; i < static_cast<int>(indice.size()) - 1; ++i) {
         indice_map.emplace(indice[i], indice[i + 1]);
       }
 
-      for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
+      for (auto i = 0; i < static_cast<int>(_problem.tiles().size()); ++i) {
         const auto& it = indice_map.find(i);
         if (it != std::end(indice_map)) {
           node[i] = it->second;
         } else {
-          node[i] = _adjacencies[i][rand() % _adjacencies[i].size()];
+          node[i] = _problem.adjacencies()[i][_rand.bounded(_problem.adjacencies()[i].size())];
         }
       }
 
       return node;
     }
 
-    const auto path(const std::vector<std::uint16_t>& node) const noexcept {
-      std::vector<std::uint16_t> indice; indice.reserve(_tiles.size() + 1);
-      indice.emplace_back(_start_index);
+    const auto path(const std::vector<index_type>& node) const noexcept {
+      std::vector<index_type> indice; indice.reserve(_problem.tiles().size() + 1);
+      indice.emplace_back(_problem.start_index());
 
-      boost::dynamic_bitset<> indice_bitset(_tiles.size());
+      boost::dynamic_bitset<> indice_bitset(_problem.tiles().size());
 
       std::uint16_t point_capacity = 1;
 
-      for (auto index = node[_start_index]; ; index = node[index]) {
+      for (auto index = node[_problem.start_index()]; ; index = node[index]) {
         if (indice_bitset[index]) {
           break;
         }
 
-        auto next_index_point = _points[index];
+        auto next_index_point = _problem.adjacencies()[index].point();
 
         if (next_index_point > point_capacity) {
           break;
@@ -258,99 +619,462 @@ namespace hexagonal_walk {
       return indice;
     }
 
-    const auto cycle(const std::vector<std::uint16_t>& path) const noexcept {
+    const auto cycle(const std::vector<index_type>& path) const noexcept {
       if (path.front() == path.back()) {
         return path;
       }
 
-      return std::vector<std::uint16_t>{_start_index};
+      return std::vector<index_type>{_problem.start_index()};
     }
 
-    const auto score(const std::vector<std::uint16_t>& node) const noexcept {
-      const auto path = local_search::path(node);
-      const auto cycle = local_search::cycle(path);
+    // 経路を差分で評価するための作業領域です。nodeを変更しても、変更した箇所に辿り着くまでの経路は変わりません。だから、そこから先だけを辿り直します。
+    class path_evaluator {
+      static constexpr index_type none = std::numeric_limits<index_type>::max();
+
+      const Problem& _problem;
+      std::vector<index_type> _path;
+      std::vector<index_type> _positions;              // 経路上の位置。経路外とスタートはnoneです。
+      std::vector<int> _path_points;                   // 経路のその位置までのポイントの合計。
+      std::vector<std::uint16_t> _point_capacities;    // 経路のその位置で、踏むことができるポイント。
+      std::vector<std::uint32_t> _stamps;              // 辿り直しの際に踏んだタイル。毎回クリアしなくて済むように、epochと比較します。
+      std::uint32_t _epoch;
+      int _score;
+      int _point;
+
+      const auto score(const int& size, const int& point, const bool& is_cycle) const noexcept {
+        return (is_cycle ? point + size : 1) + size * 3;
+      }
+
+    public:
+      path_evaluator(const Problem& problem, const std::vector<index_type>& node) noexcept
+        : _problem(problem), _path(), _positions(problem.tiles().size(), none), _path_points(), _point_capacities(), _stamps(problem.tiles().size(), 0), _epoch(0), _score(0), _point(0)
+      {
+        _path.reserve(_problem.tiles().size() + 1);
+        _path_points.reserve(_problem.tiles().size() + 1);
+        _point_capacities.reserve(_problem.tiles().size() + 1);
+
+        _path.emplace_back(_problem.start_index());
+        _path_points.emplace_back(0);
+        _point_capacities.emplace_back(1);
+
+        update(node, 0);
+      }
+
+      // indexのnodeを変更した場合に、経路が変わり始める位置を返します。経路に影響しない場合はnoneです。
+      const auto changed_position(const index_type& index) const noexcept {
+        return index == _problem.start_index() ? static_cast<index_type>(0) : _positions[index];
+      }
+
+      // changed_positionより前は変わっていないnodeのスコアと、閉路のポイントを返します。
+      const auto evaluate(const std::vector<index_type>& node, const index_type& changed_position) noexcept {
+        if (changed_position == none) {
+          return std::make_tuple(_score, _point);
+        }
+
+        if (++_epoch == 0) {
+          boost::fill(_stamps, 0);
+          _epoch = 1;
+        }
+
+        auto size = static_cast<int>(changed_position) + 1;
+        auto point = _path_points[changed_position];
+        auto point_capacity = _point_capacities[changed_position];
+        auto last_index = _path[changed_position];
+
+        for (auto index = node[last_index]; ; index = node[index]) {
+          if (_positions[index] <= changed_position || _stamps[index] == _epoch) {
+            break;
+          }
+
+          const auto next_index_point = _problem.adjacencies()[index].point();
+
+          if (next_index_point > point_capacity) {
+            break;
+          }
+
+          ++size;
+          point += next_index_point;
+          _stamps[index] = _epoch;
+          point_capacity = std::max<std::uint16_t>(point_capacity, next_index_point + 1);
+          last_index = index;
+
+          if (index == _problem.start_index()) {
+            break;
+          }
+        }
+
+        const auto is_cycle = last_index == _problem.start_index() && size > 1;
 
-      return point(cycle) + static_cast<int>(cycle.size()) + static_cast<int>(path.size()) * 3;
+        return std::make_tuple(score(size, point, is_cycle), is_cycle ? point : 0);
+      }
+
+      // nodeを変更した後に、changed_positionから先の経路を作り直します。
+      void update(const std::vector<index_type>& node, const index_type& changed_position) noexcept {
+        if (changed_position == none) {
+          return;
+        }
+
+        for (auto i = static_cast<int>(changed_position) + 1; i < static_cast<int>(_path.size()); ++i) {
+          _positions[_path[i]] = none;
+        }
+        _positions[_problem.start_index()] = none;
+
+        _path.resize(changed_position + 1);
+        _path_points.resize(changed_position + 1);
+        _point_capacities.resize(changed_position + 1);
+
+        for (auto index = node[_path.back()]; ; index = node[index]) {
+          if (_positions[index] != none) {
+            break;
+          }
+
+          const auto next_index_point = _problem.adjacencies()[index].point();
+
+          if (next_index_point > _point_capacities.back()) {
+            break;
+          }
+
+          _path_points.emplace_back(_path_points.back() + next_index_point);
+          _point_capacities.emplace_back(std::max<std::uint16_t>(_point_capacities.back(), next_index_point + 1));
+          _path.emplace_back(index);
+
+          if (index == _problem.start_index()) {
+            break;
+          }
+
+          _positions[index] = _path.size() - 1;
+        }
+
+        const auto is_cycle = _path.size() > 1 && _path.back() == _problem.start_index();
+
+        _score = score(_path.size(), _path_points.back(), is_cycle);
+        _point = is_cycle ? _path_points.back() : 0;
+      }
+
+      const auto& score() const noexcept {
+        return _score;
+      }
+
+      const auto& point() const noexcept {
+        return _point;
+      }
+    };
+
+    // ランダムに選んだ3つのタイルの次のタイルを、ランダムに変更します。元の値をoriginal_valuesに記録して、経路が変わり始める位置を返します。
+    const auto mutate(std::vector<index_type>& node, const std::vector<index_type>& changeable_indice, xoshiro256& rand, const path_evaluator& path_evaluator, boost::container::static_vector<std::pair<index_type, index_type>, 3>& original_values) const noexcept {
+      original_values.clear();
+
+      for (auto j = 0; j < 3; ++j) {
+        auto index = changeable_indice[rand.bounded(changeable_indice.size())];
+
+        if (boost::find_if(original_values, [&](const auto& original_value) { return original_value.first == index; }) == std::end(original_values)) {
+          original_values.emplace_back(index, node[index]);
+        }
+        node[index] = _problem.adjacencies()[index][rand.bounded(_problem.adjacencies()[index].size())];
+      }
+
+      auto result = std::numeric_limits<index_type>::max();
+      for (const auto& original_value : original_values) {
+        result = std::min(result, path_evaluator.changed_position(original_value.first));
+      }
+
+      return result;
     }
 
-    const auto compute(const std::vector<std::uint16_t>& initial_node, const std::vector<std::uint16_t>& changeable_indice) const noexcept {
-      std::random_device random_device;
-      std::default_random_engine rand(random_device());
+    // 焼きなましの、一つの温度の鎖です。山登りと違って、悪くなる変更も温度に応じた確率で受け入れます。
+    class replica {
+      std::vector<index_type> _node;
+      path_evaluator _path_evaluator;
+      xoshiro256 _rand;
+      double _temperature;
+      std::vector<index_type> _answer_node;
+      int _answer_node_point;
+
+    public:
+      replica(const Problem& problem, const std::vector<index_type>& node, const double& temperature, const std::uint64_t& seed) noexcept
+        : _node(node), _path_evaluator(problem, _node), _rand(seed), _temperature(temperature), _answer_node(node), _answer_node_point(_path_evaluator.point())
+      {
+        ;
+      }
+
+      // 採用した変更の数を返します。
+      const auto run(const local_search& local_search, const std::vector<index_type>& changeable_indice, const int& size) noexcept {
+        boost::container::static_vector<std::pair<index_type, index_type>, 3> original_values;
+        auto result = 0;
+
+        for (auto i = 0; i < size && !local_search._stop; ++i) {  // 大きな盤面では1000手に時間がかかるので、止められたらすぐに抜けます。
+          const auto changed_position = local_search.mutate(_node, changeable_indice, _rand, _path_evaluator, original_values);
+
+          int node_score, node_point;
+          std::tie(node_score, node_point) = _path_evaluator.evaluate(_node, changed_position);
+
+          const auto score_delta = node_score - _path_evaluator.score();
+
+          if (score_delta < 0 && _rand.uniform() >= std::exp(score_delta / _temperature)) {
+            for (const auto& original_value : original_values) {
+              _node[original_value.first] = original_value.second;
+            }
+
+            continue;
+          }
+
+          _path_evaluator.update(_node, changed_position);
+          ++result;
+
+          if (node_point > _answer_node_point) {
+            _answer_node = _node;
+            _answer_node_point = node_point;
+          }
+        }
+
+        return result;
+      }
+
+      void reset(const std::vector<index_type>& node) noexcept {
+        _node = node;
+        _path_evaluator.update(_node, 0);
+      }
+
+      const auto score() const noexcept {
+        return _path_evaluator.score();
+      }
+
+      auto& temperature() noexcept {
+        return _temperature;
+      }
+
+      const auto& answer_node() const noexcept {
+        return _answer_node;
+      }
+
+      const auto& answer_node_point() const noexcept {
+        return _answer_node_point;
+      }
+    };
+
+    // レプリカ交換法です。温度の違う鎖を並列に動かして、一定の回数ごとに隣り合う温度の鎖の状態を確率的に交換します。高温の鎖で谷を越えた状態が、低温の鎖に降りてきます。
+    const auto temper(const std::vector<index_type>& initial_node, const std::vector<index_type>& changeable_indice) noexcept {
+      _progress.start();
+
+      // 1タイルあたりのスコアは数点なので、温度は0.5から20までを等比で分けます。
+      std::vector<replica> replicas; replicas.reserve(_replica_size);
+      for (auto i = 0; i < _replica_size; ++i) {
+        replicas.emplace_back(_problem, initial_node, 0.5 * std::pow(20.0 / 0.5, static_cast<double>(i) / (_replica_size - 1)), _rand());
+      }
+
+      std::vector<int> orders(_replica_size);  // 温度が低い順の、レプリカの添字です。
+      boost::iota(orders, 0);
 
       auto answer_node = initial_node;
-      auto answer_node_point = point(cycle(path(initial_node)));
-      auto best_score = score(initial_node);
+      auto answer_node_point = replicas.front().answer_node_point();
+
+      for (auto iteration = static_cast<std::size_t>(0); !_stop && iteration < _iteration_limit; ++iteration) {
+        // レプリカごとに乱数を持っているので、スレッドへの割り振り方を変えても結果は変わりません。
+        const auto run = [&](const int& thread) {
+          auto result = 0;
+
+          for (auto i = thread; i < _replica_size; i += _replica_threads) {
+            result += replicas[i].run(*this, changeable_indice, 1000);
+          }
+
+          return result;
+        };
+
+        std::vector<std::future<int>> futures;
+        for (auto i = 1; i < _replica_threads; ++i) {
+          futures.emplace_back(_thread_pool.submit([&, i]() { return run(i); }));
+        }
+
+        auto move_count = run(0);
+
+        for (auto& future : futures) {
+          move_count += future.get();
+        }
+
+        _evaluation_count.add(1000 * _replica_size);
+        _move_count.add(move_count);
+
+        for (const auto& replica : replicas) {
+          if (replica.answer_node_point() > answer_node_point) {
+            answer_node = replica.answer_node();
+            answer_node_point = replica.answer_node_point();
+
+            _progress.improve();
+
+            if (_incumbent) {
+              _incumbent->publish(cycle(path(answer_node)), answer_node_point);
+            }
+          }
+        }
+
+        for (auto i = 0; i < _replica_size - 1; ++i) {
+          auto& replica_1 = replicas[orders[i]];      // 低温の方。
+          auto& replica_2 = replicas[orders[i + 1]];  // 高温の方。
+
+          if (_rand.uniform() < std::exp((1.0 / replica_1.temperature() - 1.0 / replica_2.temperature()) * (replica_2.score() - replica_1.score()))) {
+            std::swap(replica_1.temperature(), replica_2.temperature());
+            std::swap(orders[i], orders[i + 1]);
+
+            _replica_swap_count.add(1);
+          }
+        }
+
+        // 他の探索の方が良い解を見つけていたら、一番低温の鎖をそこからやり直させます。
+        if (_incumbent && _incumbent->point() > answer_node_point) {
+          const auto& solution = _incumbent->get();
+
+          answer_node = node(solution->indice());
+          answer_node_point = solution->point();
+
+          replicas[orders[0]].reset(answer_node);
+
+          _restart_count.add(1);
+        }
+      }
+
+      return answer_node;
+    }
+
+    const auto compute(const std::vector<index_type>& initial_node, const std::vector<index_type>& changeable_indice) noexcept {
+      _progress.start();
+
       auto node = initial_node;
+      path_evaluator path_evaluator(_problem, node);
+
+      auto answer_node = initial_node;
+      auto answer_node_point = path_evaluator.point();
+      auto best_score = path_evaluator.score();
       auto staying_count = 0;
 
-      std::unordered_map<std::uint16_t, std::uint16_t> original_values(3);  // 同じ箇所が複数回変更された場合にも元の値を保持するために、mapを使用します。
+      boost::container::static_vector<std::pair<index_type, index_type>, 3> original_values;  // 同じ箇所が複数回変更された場合にも元の値を保持するために、最初の値だけを記録します。
+      boost::container::static_vector<std::pair<index_type, index_type>, 3> next_values;
 
-      while (staying_count++ < 30000 && !_stop) {
+      std::uint64_t evaluation_count = 0;  // カウンターには、最後にまとめて足し込みます。
+      std::uint64_t move_count = 0;
+
+      while (staying_count++ < 30000 && !_stop && evaluation_count < _iteration_limit) {
         // コピー作成のコストを回避した結果、一つのデータに対して修正と復帰を繰り返すわかりづらいコードになってしまいました……。
 
-        std::vector<std::uint16_t> next_node; next_node.reserve(_tiles.size());
         auto next_node_score = 0;
+        auto next_node_point = 0;
+        auto next_node_changed_position = std::numeric_limits<index_type>::max();
 
         for (auto i = 0; i < std::min<int>(changeable_indice.size() * 3, 120); ++i) {
-          original_values.clear();
+          const auto changed_position = mutate(node, changeable_indice, _rand, path_evaluator, original_values);
 
-          for (auto j = 0; j < 3; ++j) {
-            auto index = changeable_indice[rand() % changeable_indice.size()];
+          int node_score, node_point;
+          std::tie(node_score, node_point) = path_evaluator.evaluate(node, changed_position);
 
-            original_values.emplace(index, node[index]);
-            node[index] = _adjacencies[index][rand() % _adjacencies[index].size()];
-          }
+          ++evaluation_count;
 
-          const auto node_score = score(node);
           if (node_score > next_node_score) {
             next_node_score = node_score;
-            next_node = node;
+            next_node_point = node_point;
+            next_node_changed_position = changed_position;
+
+            next_values.clear();
+            for (const auto& original_value : original_values) {
+              next_values.emplace_back(original_value.first, node[original_value.first]);
+            }
           }
 
-          for (const auto original_value : original_values) {
+          for (const auto& original_value : original_values) {
             node[original_value.first] = original_value.second;
           }
         }
 
+        for (const auto& next_value : next_values) {
+          node[next_value.first] = next_value.second;
+        }
+        path_evaluator.update(node, next_node_changed_position);
+        ++move_count;
+
         if (next_node_score > best_score) {
           best_score = next_node_score;
           staying_count = 0;
+
+          _progress.improve();
         }
 
-        const auto next_node_point = point(cycle(path(next_node)));
         if (next_node_point > answer_node_point) {
-          answer_node = next_node;
+          answer_node = node;
           answer_node_point = next_node_point;
+
+          if (_incumbent) {
+            _incumbent->publish(cycle(path(answer_node)), answer_node_point);
+          }
         }
 
-        node = std::move(next_node);
+        // 行き詰まったら、共有の解の方が良いかを確認して、良ければそこからやり直します。
+        if (_incumbent && staying_count > 0 && staying_count % 3000 == 0 && _incumbent->point() > answer_node_point) {
+          const auto& solution = _incumbent->get();
+
+          node = this->node(solution->indice());
+          path_evaluator.update(node, 0);
+
+          answer_node = node;
+          answer_node_point = path_evaluator.point();
+          best_score = path_evaluator.score();
+          staying_count = 0;
+
+          _restart_count.add(1);
+        }
       }
 
+      _evaluation_count.add(evaluation_count);
+      _move_count.add(move_count);
+
       return answer_node;
     }
 
   public:
-    local_search() noexcept
-      : _stop(false)
+    local_search(const Problem& problem, hexagonal_walk::incumbent<index_type>* incumbent = nullptr, const int& replica_size = 1, const int& replica_threads = 1, const std::uint64_t& seed = std::random_device()()) noexcept
+      : _problem(problem), _stop(false), _progress(), _incumbent(incumbent), _replica_size(replica_size), _replica_threads(std::max(std::min(replica_threads, replica_size), 1)), _rand(seed), _iteration_limit(std::numeric_limits<std::size_t>::max()), _thread_pool(_replica_threads - 1), _evaluation_count(), _move_count(), _restart_count(), _replica_swap_count()
     {
       ;
     }
 
-    const auto operator()(const std::vector<std::uint16_t>& indice, const std::vector<std::uint16_t>& changeable_indice) noexcept {
+    const auto operator()(const std::vector<index_type>& indice, const std::vector<index_type>& changeable_indice) noexcept {
       if (changeable_indice.empty()) {
         return indice;
       }
 
-      return cycle(path(compute(node(indice), changeable_indice)));
+      return cycle(path(_replica_size > 1 ? temper(node(indice), changeable_indice) : compute(node(indice), changeable_indice)));
     }
 
     const auto stop() noexcept {
       _stop = true;
     }
+
+    const auto stopped() const noexcept {
+      return static_cast<bool>(_stop);
+    }
+
+    // 時間ではなく回数で探索を打ち切ります。同じシードなら、同じ解になります。
+    // iteration_limitは、他の探索と揃えて評価する手の数です。山登りは評価した手の数で打ち切り、レプリカ交換法は、1回の交換までに全てのレプリカで1000手ずつ評価するので交換の回数に換算します。
+    const auto limit_iterations(const std::size_t& iteration_limit) noexcept {
+      _iteration_limit = _replica_size > 1 ? std::max<std::size_t>(iteration_limit / (1000 * _replica_size), 1) : iteration_limit;
+    }
+
+    const auto& progress() const noexcept {
+      return _progress;
+    }
+
+    // カウンターの値を、nameを前置した名前でcountersに足し込みます。
+    const auto report(counters& counters, const std::string& name) const noexcept {
+      counters.add(name + ".evaluations", _evaluation_count.value());
+      counters.add(name + ".moves", _move_count.value());
+      counters.add(name + ".restarts", _restart_count.value());
+      counters.add(name + ".replica_swaps", _replica_swap_count.value());
+    }
   };
 
-  inline auto indice_bitset(const std::vector<std::uint16_t>& indice) noexcept {
-    boost::dynamic_bitset<> result(_tiles.size());
+  template <typename Problem>
+  constexpr typename Problem::index_type local_search<Problem>::path_evaluator::none;
+
+  template <typename Problem>
+  inline auto indice_bitset(const Problem& problem, const std::vector<typename Problem::index_type>& indice) noexcept {
+    boost::dynamic_bitset<> result(problem.tiles().size());
     boost::for_each(
       indice,
       [&](const auto& index) {
@@ -360,24 +1084,26 @@ namespace hexagonal_walk {
     return result;
   }
 
-  inline auto all_indice() noexcept {
-    std::vector<std::uint16_t> result; result.reserve(_tiles.size());
+  template <typename Problem>
+  inline auto all_indice(const Problem& problem) noexcept {
+    std::vector<typename Problem::index_type> result; result.reserve(problem.tiles().size());
 
-    for (auto i = 0; i < static_cast<int>(_tiles.size()); ++i) {
+    for (auto i = 0; i < static_cast<int>(problem.tiles().size()); ++i) {
       result.emplace_back(i);
     }
 
     return result;
   }
 
-  inline auto maybe_visitable_indice(const std::vector<std::uint16_t>& indice) noexcept {
-    std::vector<std::uint16_t> result; result.reserve(_tiles.size());
+  template <typename Problem>
+  inline auto maybe_visitable_indice(const Problem& problem, const std::vector<typename Problem::index_type>& indice) noexcept {
+    std::vector<typename Problem::index_type> result; result.reserve(problem.tiles().size());
 
-    const auto& indice_bitset = hexagonal_walk::indice_bitset(indice);
+    const auto& indice_bitset = hexagonal_walk::indice_bitset(problem, indice);
 
     for (const auto& index : indice) {
       if ([&]() {
-          for (const auto& adjacency_index : _adjacencies[index]) {
+          for (const auto& adjacency_index : problem.adjacencies()[index]) {
             if (!indice_bitset[adjacency_index]) {
               return true;
             }
@@ -386,7 +1112,7 @@ namespace hexagonal_walk {
           return false;
         }())
       {
-        boost::copy(_adjacencies[index], std::back_inserter(result));
+        boost::copy(problem.adjacencies()[index], std::back_inserter(result));
         result.emplace_back(index);
       }
     }
@@ -396,87 +1122,280 @@ namespace hexagonal_walk {
     return result;
   }
 
+  // point()の上限です。これに達した解は最適なので、それ以上探索する必要はありません。
+  // 行って戻るだけの経路を除けば、経路の上のタイルには経路の上の隣が2つあって、しかもポイントの条件を満たしながらスタートから辿り着けなければなりません。
+  // だから、使えるタイルの隣が2つ未満のタイルと、ポイントが足りなくて辿り着けないタイルを、変わらなくなるまで繰り返し除いて、残ったタイルのポイントを合計します。
+  // 六角形の盤面には3つのタイルが互いに隣り合う三角形があって二部グラフにならないので、市松模様の偶奇による上限は使えません。
+  template <typename Problem>
+  inline auto point_upper_bound(const Problem& problem) noexcept {
+    using index_type = typename Problem::index_type;
+
+    const auto& start_index = problem.start_index();
+
+    boost::dynamic_bitset<> available_indice_bitset(problem.tiles().size());
+    available_indice_bitset.set();
+
+    std::vector<int> degrees(problem.tiles().size());
+    std::vector<index_type> queue; queue.reserve(problem.tiles().size());
+    std::vector<std::vector<index_type>> pending_indices(std::numeric_limits<std::uint8_t>::max() + 2);  // ポイントごとの、上限を超えていて辿れなかったタイルです。
+
+    for (auto changed = true; changed; ) {
+      changed = false;
+
+      // 使えるタイルの隣が2つ未満のタイルを、除けなくなるまで除きます。
+      queue.clear();
+
+      for (auto i = 0; i < static_cast<int>(problem.tiles().size()); ++i) {
+        if (!available_indice_bitset[i]) {
+          continue;
+        }
+
+        degrees[i] = boost::count_if(problem.adjacencies()[i], [&](const auto& adjacency_index) { return available_indice_bitset[adjacency_index]; });
+
+        if (static_cast<index_type>(i) != start_index && degrees[i] < 2) {
+          queue.emplace_back(i);
+        }
+      }
+
+      for (auto i = 0; i < static_cast<int>(queue.size()); ++i) {
+        available_indice_bitset[queue[i]] = false;
+        changed = true;
+
+        for (const auto& adjacency_index : problem.adjacencies()[queue[i]]) {
+          if (available_indice_bitset[adjacency_index] && adjacency_index != start_index && --degrees[adjacency_index] == 1) {
+            queue.emplace_back(adjacency_index);
+          }
+        }
+      }
+
+      // ポイントの上限以下のタイルだけを辿って広げます。上限を超えていたタイルはポイントごとに取っておいて、上限が上がったら、そこから辿り直さずに続けます。
+      boost::dynamic_bitset<> reached_indice_bitset(problem.tiles().size());
+      reached_indice_bitset[start_index] = true;
+
+      queue.clear();
+      queue.emplace_back(start_index);
+
+      for (auto& pending_indice : pending_indices) {
+        pending_indice.clear();
+      }
+
+      auto point_capacity = 1;
+      auto released_point = 1;  // ここまでのポイントの取っておいたタイルは、辿り終えています。
+
+      for (auto i = 0; i < static_cast<int>(queue.size()); ++i) {
+        for (const auto& adjacency_index : problem.adjacencies()[queue[i]]) {
+          if (!available_indice_bitset[adjacency_index] || reached_indice_bitset[adjacency_index]) {
+            continue;
+          }
+
+          const auto& point = problem.adjacencies()[adjacency_index].point();
+
+          if (point > point_capacity) {
+            pending_indices[point].emplace_back(adjacency_index);
+            continue;
+          }
+
+          reached_indice_bitset[adjacency_index] = true;
+          queue.emplace_back(adjacency_index);
+
+          point_capacity = std::max<int>(point_capacity, point + 1);
+        }
+
+        while (released_point < point_capacity) {
+          ++released_point;
+
+          for (const auto& pending_index : pending_indices[released_point]) {
+            if (reached_indice_bitset[pending_index]) {
+              continue;
+            }
+
+            reached_indice_bitset[pending_index] = true;
+            queue.emplace_back(pending_index);
+
+            point_capacity = std::max<int>(point_capacity, released_point + 1);
+          }
+        }
+      }
+
+      if ((available_indice_bitset - reached_indice_bitset).any()) {
+        available_indice_bitset &= reached_indice_bitset;
+        changed = true;
+      }
+    }
+
+    auto result = 0;
+
+    for (auto i = 0; i < static_cast<int>(problem.tiles().size()); ++i) {
+      if (available_indice_bitset[i]) {
+        result += problem.points()[i];
+      }
+    }
+
+    // 行って戻るだけの経路です。最初に踏めるのは、ポイントが1のタイルだけです。
+    for (const auto& adjacency_index : problem.adjacencies()[start_index]) {
+      result = std::max<int>(result, problem.adjacencies()[adjacency_index].point() <= 1 ? problem.adjacencies()[adjacency_index].point() : 0);
+    }
+
+    return result;
+  }
+
+  template <typename Problem>
   class fattening {
+    using index_type = typename Problem::index_type;
+
+    const Problem& _problem;
     std::atomic<bool> _stop;
+    hexagonal_walk::incumbent<index_type>* _incumbent;
+
+    counter _detour_search_count;  // 迂回路を探した回数です。
+    counter _insertion_count;      // 迂回路を挿入した回数です。
+    counter _inserted_tile_count;  // 挿入したタイルの数です。
 
   public:
-    fattening() noexcept
-      : _stop(false)
+    fattening(const Problem& problem, hexagonal_walk::incumbent<index_type>* incumbent = nullptr) noexcept
+      : _problem(problem), _stop(false), _incumbent(incumbent), _detour_search_count(), _insertion_count(), _inserted_tile_count()
     {
       ;
     }
 
-    const auto operator()(const std::vector<std::uint16_t>& indice) noexcept {
-      std::vector<std::uint16_t> result; result.reserve(_tiles.size() + 1);
-      result = indice;
+    // index_1とindex_2の間に挟める、1〜3枚のタイルの迂回路です。短い迂回路を優先します。見つからなければ空です。
+    const auto detour(const std::vector<index_type>& nexts, const index_type& index_1, const index_type& index_2, const int& point_capacity) const noexcept {
+      boost::container::static_vector<index_type, 3> result;
 
-      auto result_bitset = hexagonal_walk::indice_bitset(indice);
+      const auto insertable = [&](const index_type& index, const int& point_capacity) {
+        return nexts[index] == std::numeric_limits<index_type>::max() && index != _problem.start_index() && _problem.adjacencies()[index].point() <= point_capacity;
+      };
 
-      auto inserted_index = 0;
-      auto inserted = true;
-      while (inserted && !_stop) {
-        inserted = false;
+      const auto next_point_capacity = [&](const index_type& index, const int& point_capacity) {
+        return std::max(point_capacity, _problem.adjacencies()[index].point() + 1);
+      };
 
-        auto point_capacity = 1;
-        for (auto i = 0; i < static_cast<int>(result.size()) - 1 && !_stop; ++i) {
-          if (_points[result[i]] == point_capacity) {
-            ++point_capacity;
+      const auto is_adjacent = [&](const index_type& index, const index_type& adjacency_index) {
+        return boost::find(_problem.adjacencies()[index], adjacency_index) != std::end(_problem.adjacencies()[index]);
+      };
+
+      // 1枚：index_1とindex_2の両方に隣接するタイル。
+      for (const auto& index : _problem.adjacencies()[index_1]) {
+        if (insertable(index, point_capacity) && is_adjacent(index, index_2)) {
+          result.emplace_back(index);
+          return result;
+        }
+      }
+
+      // 2枚：index_1 → u → v → index_2。
+      for (const auto& u : _problem.adjacencies()[index_1]) {
+        if (!insertable(u, point_capacity)) {
+          continue;
+        }
+
+        for (const auto& v : _problem.adjacencies()[u]) {
+          if (v != index_2 && insertable(v, next_point_capacity(u, point_capacity)) && is_adjacent(v, index_2)) {
+            result.emplace_back(u);
+            result.emplace_back(v);
+            return result;
           }
+        }
+      }
 
-          if (i < inserted_index) {
+      // 3枚：index_1 → u → v → w → index_2。
+      for (const auto& u : _problem.adjacencies()[index_1]) {
+        if (!insertable(u, point_capacity)) {
+          continue;
+        }
+
+        for (const auto& v : _problem.adjacencies()[u]) {
+          if (v == index_2 || !insertable(v, next_point_capacity(u, point_capacity))) {
             continue;
           }
 
-          const auto& adjacency_1 = _adjacencies[result[i]];
-          const auto& adjacency_2 = _adjacencies[result[i + 1]];
+          for (const auto& w : _problem.adjacencies()[v]) {
+            if (w != u && w != index_2 && insertable(w, next_point_capacity(v, next_point_capacity(u, point_capacity))) && is_adjacent(w, index_2)) {
+              result.emplace_back(u);
+              result.emplace_back(v);
+              result.emplace_back(w);
+              return result;
+            }
+          }
+        }
+      }
 
-          auto it_1 = std::begin(adjacency_1);
-          auto it_2 = std::begin(adjacency_2);
+      return result;
+    }
 
-          while (it_1 != std::end(adjacency_1) && it_2 != std::end(adjacency_2)) {
-            if (*it_1 < *it_2) {
-              ++it_1;
-              continue;
-            }
+    // 経路を、タイルごとの次のタイルの添字（_nexts）で表現します。これなら、タイルの挿入はO(1)です。
+    // 挿入できる場所を、経路の順に一度だけ辿ります。挿入したら、同じ場所からもう一度試します。ポイントの上限は経路の前の部分だけで決まるので、通り過ぎた辺に挿入できるようになることはありません。
+    const auto operator()(const std::vector<index_type>& indice) noexcept {
+      constexpr auto none = std::numeric_limits<index_type>::max();
 
-            if (*it_2 < *it_1) {
-              ++it_2;
-              continue;
-            }
+      std::vector<index_type> nexts(_problem.tiles().size(), none);  // 経路上にないタイルはnoneです。
+      for (auto i = 0; i < static_cast<int>(indice.size()) - 1; ++i) {
+        nexts[indice[i]] = indice[i + 1];
+      }
 
-            if (!result_bitset[*it_1] && _points[*it_1] <= point_capacity) {
-              result.insert(std::begin(result) + i + 1, *it_1);
-              result_bitset[*it_1] = true;
+      std::uint64_t detour_search_count = 0;  // カウンターには、最後にまとめて足し込みます。
+      std::uint64_t insertion_count = 0;
+      std::uint64_t inserted_tile_count = 0;
 
-              if (!inserted) {
-                inserted_index = i;
-              }
-              inserted = true;
+      auto point_capacity = 1;
+      for (auto index = _problem.start_index(); !_stop; ) {
+        const auto& detour = this->detour(nexts, index, nexts[index], point_capacity);
 
-              ++i;
-              break;
-            }
+        ++detour_search_count;
 
-            ++it_1;
-            ++it_2;
+        if (!detour.empty()) {
+          ++insertion_count;
+          inserted_tile_count += detour.size();
+
+          for (const auto& detour_index : detour | boost::adaptors::reversed) {
+            nexts[detour_index] = nexts[index];
+            nexts[index] = detour_index;
           }
+
+          continue;
+        }
+
+        index = nexts[index];
+
+        if (index == _problem.start_index()) {
+          break;
         }
+
+        point_capacity = std::max(point_capacity, _problem.adjacencies()[index].point() + 1);
+      }
+
+      _detour_search_count.add(detour_search_count);
+      _insertion_count.add(insertion_count);
+      _inserted_tile_count.add(inserted_tile_count);
+
+      std::vector<index_type> result; result.reserve(_problem.tiles().size() + 1);
+
+      result.emplace_back(_problem.start_index());
+      for (auto index = nexts[_problem.start_index()]; ; index = nexts[index]) {
+        result.emplace_back(index);
+
+        if (index == _problem.start_index()) {
+          break;
+        }
+      }
+
+      if (_incumbent) {
+        _incumbent->publish(result, hexagonal_walk::point(_problem, result));
       }
 
       return result;
     }
 
     const auto operator()() noexcept {
-      std::vector<std::uint16_t> indice; indice.reserve(3);
+      std::vector<index_type> indice; indice.reserve(3);
 
-      indice.emplace_back(_start_index);
-      for (const auto& adjacency_index : _adjacencies[_start_index]) {
-        if (_points[adjacency_index] == 1) {
+      indice.emplace_back(_problem.start_index());
+      for (const auto& adjacency_index : _problem.adjacencies()[_problem.start_index()]) {
+        if (_problem.adjacencies()[adjacency_index].point() == 1) {
           indice.emplace_back(adjacency_index);
           break;
         }
       }
-      indice.emplace_back(_start_index);
+      indice.emplace_back(_problem.start_index());
 
       return (*this)(indice);
     }
@@ -484,72 +1403,200 @@ namespace hexagonal_walk {
     const auto stop() noexcept {
       _stop = true;
     }
+
+    // カウンターの値を、nameを前置した名前でcountersに足し込みます。
+    const auto report(counters& counters, const std::string& name) const noexcept {
+      counters.add(name + ".detour_searches", _detour_search_count.value());
+      counters.add(name + ".insertions", _insertion_count.value());
+      counters.add(name + ".inserted_tiles", _inserted_tile_count.value());
+    }
   };
 
+  template <typename Problem>
   class depth_first_search {  // 単純なフィールドでの速度勝負に対応するために、素の深さ有線探索を追加しました。。。
+    using index_type = typename Problem::index_type;
+
+    const Problem& _problem;
     std::atomic<bool> _stop;
-    boost::container::static_vector<std::uint16_t, 64 + 1> _result;
+    std::vector<index_type> _result;
     int _result_point;
-    const std::uint64_t _start_index_bit;
     bool _finished;
+    std::size_t _iteration_limit;  // 試す手の数の上限です。上限に達したら、止めた場合と同じく解なしとします。
+    hexagonal_walk::incumbent<index_type>* _incumbent;
 
-    const auto compute(const boost::container::static_vector<std::uint16_t, 64 + 1>& indice, const std::uint64_t& indice_bitset, const std::uint8_t& point_capacity) noexcept {
-      if (indice_bitset & _start_index_bit) {
-        const auto indice_point = point(indice);
+    counter _step_count;      // 試した手の数です。
+    counter _pruning_count;   // 上限で刈った枝の数です。
+    counter _solution_count;  // 解を更新した回数です。
 
-        if (indice_point > _result_point) {
-          _result = indice;
-          _result_point = indice_point;
+    // 再帰すると経路のコピーが必要になるので、深さごとの状態を配列に持つ明示的なスタックで探索します。ビット・ボードの幅は、タイルの数に合わせて選びます。
+    template <std::size_t Width>
+    void compute() noexcept {
+      std::array<index_type, Width + 1> path;            // 経路です。push/popは、depthを動かすだけです。
+      std::array<std::uint8_t, Width + 1> next_positions;  // 次に試す、隣接するタイルの位置です。
+      std::array<std::uint8_t, Width + 1> point_capacities;
+      std::array<int, Width + 1> points;
 
-          if (_result.size() == _tiles.size() + 1) {
-            _finished = true;
-          }
+      bitboard<Width> indice_bitboard;  // スタートは、ゴールするまで含めません。
+
+      std::vector<bitboard<Width>> adjacency_bitboards(_problem.tiles().size());
+      bitboard<Width> all_indice_bitboard;
+
+      for (auto i = 0; i < static_cast<int>(_problem.tiles().size()); ++i) {
+        for (const auto& adjacency_index : _problem.adjacencies()[i]) {
+          adjacency_bitboards[i].set(adjacency_index);
         }
 
-        return;
+        all_indice_bitboard.set(i);
       }
 
-      for (const auto& next_index : _adjacencies[indice.back()]) {
-        if (_stop || _finished) {
-          return;
+      // indexからこれから獲得できるポイントの上限です。スタートに戻れない場合は-1です。
+      // 訪問済みのタイルとスタートを通らずに辿り着けるタイルのうち、通り抜けられる（隣に、辿り着けるタイルかindexが2つ以上ある）タイルのポイントを合計します。
+      const auto upper_bound = [&](const index_type& index) {
+        const auto available_bitboard = bitboard<Width>(all_indice_bitboard).subtract(indice_bitboard);
+
+        auto reachable_bitboard = adjacency_bitboards[index] & available_bitboard;
+
+        for (auto frontier_bitboard = reachable_bitboard; frontier_bitboard.any(); ) {
+          bitboard<Width> next_frontier_bitboard;
+
+          frontier_bitboard.for_each(
+            [&](const auto& frontier_index) {
+              if (frontier_index != _problem.start_index()) {
+                next_frontier_bitboard |= adjacency_bitboards[frontier_index];
+              }
+            });
+
+          next_frontier_bitboard &= available_bitboard;
+          next_frontier_bitboard.subtract(reachable_bitboard);
+
+          reachable_bitboard |= next_frontier_bitboard;
+          frontier_bitboard = next_frontier_bitboard;
+        }
+
+        if (!reachable_bitboard.test(_problem.start_index())) {
+          return -1;
+        }
+
+        auto passable_bitboard = reachable_bitboard;
+        passable_bitboard.set(index);
+
+        auto result = 0;
+
+        reachable_bitboard.for_each(
+          [&](const auto& reachable_index) {
+            if (reachable_index != _problem.start_index() && (adjacency_bitboards[reachable_index] & passable_bitboard).count() >= 2) {
+              result += _problem.adjacencies()[reachable_index].point();
+            }
+          });
+
+        return result;
+      };
+
+      // 全体の上限に達したら、それ以上の解はないので探索を終えます。
+      const auto global_upper_bound = upper_bound(_problem.start_index());
+
+      auto depth = 0;
+      path[0] = _problem.start_index();
+      next_positions[0] = 0;
+      point_capacities[0] = 1;
+      points[0] = 0;
+
+      std::uint64_t pruning_count = 0;  // カウンターには、最後にまとめて足し込みます。
+      std::uint64_t solution_count = 0;
+
+      auto iteration = static_cast<std::size_t>(0);
+      for (; !_stop && !_finished; ++iteration) {
+        if (iteration >= _iteration_limit) {
+          _stop = true;
+          break;
         }
 
-        const auto next_index_bit = static_cast<std::uint64_t>(1) << next_index;
+        const auto& adjacency = _problem.adjacencies()[path[depth]];
+
+        if (next_positions[depth] == adjacency.size()) {
+          if (depth == 0) {
+            break;
+          }
 
-        if (indice_bitset & next_index_bit) {
+          indice_bitboard.reset(path[depth]);
+          --depth;
           continue;
         }
 
-        const auto next_index_point = _points[next_index];
+        const auto next_index = adjacency[next_positions[depth]++];
 
-        if (next_index_point > point_capacity) {
+        if (indice_bitboard.test(next_index)) {
           continue;
         }
 
-        boost::container::static_vector<std::uint16_t, 64 + 1> next_indice;
-        next_indice = indice;
-        next_indice.emplace_back(next_index);
+        const auto next_index_point = _problem.adjacencies()[next_index].point();
+
+        if (next_index_point > point_capacities[depth]) {
+          continue;
+        }
+
+        if (next_index == _problem.start_index()) {
+          if (points[depth] > _result_point) {
+            _result.assign(std::begin(path), std::begin(path) + depth + 1);
+            _result.emplace_back(next_index);
+            _result_point = points[depth];
+            ++solution_count;
+
+            if (_incumbent) {
+              _incumbent->publish(_result, _result_point);
+            }
+
+            if (_result.size() == _problem.tiles().size() + 1 || _result_point >= global_upper_bound) {
+              _finished = true;
+            }
+          }
 
-        compute(next_indice, indice_bitset | next_index_bit, std::max<std::uint8_t>(point_capacity, next_index_point + 1));
+          continue;
+        }
+
+        indice_bitboard.set(next_index);
+
+        // スタートに戻れない場合と、これまでの解を超えられない場合は、枝を刈ります。
+        const auto next_upper_bound = upper_bound(next_index);
+
+        if (next_upper_bound < 0 || points[depth] + next_index_point + next_upper_bound <= _result_point) {
+          indice_bitboard.reset(next_index);
+          ++pruning_count;
+          continue;
+        }
+
+        ++depth;
+        path[depth] = next_index;
+        next_positions[depth] = 0;
+        point_capacities[depth] = std::max<std::uint8_t>(point_capacities[depth - 1], next_index_point + 1);
+        points[depth] = points[depth - 1] + next_index_point;
       }
+
+      _step_count.add(iteration);
+      _pruning_count.add(pruning_count);
+      _solution_count.add(solution_count);
     }
 
   public:
-    depth_first_search() noexcept
-      : _stop(false), _result(), _result_point(0), _start_index_bit(static_cast<std::uint64_t>(1) << _start_index), _finished(false)
+    depth_first_search(const Problem& problem, hexagonal_walk::incumbent<index_type>* incumbent = nullptr) noexcept
+      : _problem(problem), _stop(false), _result(), _result_point(0), _finished(false), _iteration_limit(std::numeric_limits<std::size_t>::max()), _incumbent(incumbent), _step_count(), _pruning_count(), _solution_count()
     {
       ;
     }
 
     const auto operator()() noexcept {
-      if (_tiles.size() > 64) {
-        return boost::container::static_vector<std::uint16_t, 64 + 1>{};
+      if (_problem.tiles().size() <= 64) {
+        compute<64>();
+      } else if (_problem.tiles().size() <= 128) {
+        compute<128>();
+      } else if (_problem.tiles().size() <= 256) {
+        compute<256>();
+      } else {
+        return std::vector<index_type>{};
       }
 
-      compute(boost::container::static_vector<std::uint16_t, 64 + 1>{_start_index}, static_cast<std::uint64_t>(0), 1);
-
       if (_stop) {
-        return boost::container::static_vector<std::uint16_t, 64 + 1>{};
+        return std::vector<index_type>{};
       }
 
       return _result;
@@ -558,5 +1605,17 @@ namespace hexagonal_walk {
     const auto stop() noexcept {
       _stop = true;
     }
+
+    // 時間ではなく回数で探索を打ち切ります。iteration_limitは評価する手の数で、深さ優先探索では試す手の数そのものです。
+    const auto limit_iterations(const std::size_t& iteration_limit) noexcept {
+      _iteration_limit = iteration_limit;
+    }
+
+    // カウンターの値を、nameを前置した名前でcountersに足し込みます。
+    const auto report(counters& counters, const std::string& name) const noexcept {
+      counters.add(name + ".steps", _step_count.value());
+      counters.add(name + ".prunings", _pruning_count.value());
+      counters.add(name + ".solutions", _solution_count.value());
+    }
   };
 }
@@ -0,0 +1,136 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace hexagonal_walk {
+  // 固定数のスレッドで、投入された処理を順番に実行します。
+  class thread_pool {
+    std::vector<std::thread> _threads;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition_variable;
+    bool _stop;
+
+  public:
+    thread_pool(const int& size) noexcept
+      : _threads(), _tasks(), _mutex(), _condition_variable(), _stop(false)
+    {
+      for (auto i = 0; i < size; ++i) {
+        _threads.emplace_back(
+          [&]() {
+            while (true) {
+              std::function<void()> task;
+              {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition_variable.wait(lock, [&]() { return _stop || !_tasks.empty(); });
+
+                if (_tasks.empty()) {
+                  return;
+                }
+
+                task = std::move(_tasks.front()); _tasks.pop();
+              }
+
+              task();
+            }
+          });
+      }
+    }
+
+    ~thread_pool() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _condition_variable.notify_all();
+
+      for (auto& thread : _threads) {
+        thread.join();
+      }
+    }
+
+    template <typename F>
+    auto submit(F&& f) noexcept {
+      // std::functionはコピー可能でなければならないので、packaged_taskをshared_ptrで包みます。
+      const auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+      auto result = task->get_future();
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.emplace([task]() { (*task)(); });
+      }
+      _condition_variable.notify_one();
+
+      return result;
+    }
+  };
+
+  // Executor（thread_poolか、別のthread_pool_share）のスレッドのうち、同時にはsize個までしか使わずに処理を実行します。
+  // 一つのスレッド・プールを複数の問題や成分で分け合っても、一つの問題がスレッドを占領しないようにします。溢れた処理は、前の処理が終わるのを待ってから投入します。
+  template <typename Executor>
+  class thread_pool_share {
+    Executor& _executor;
+    int _size;
+    int _running_size;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition_variable;
+
+    // ロックを取った状態で呼び出します。
+    void dispatch(std::unique_lock<std::mutex>& lock) noexcept {
+      if (_running_size >= _size || _tasks.empty()) {
+        return;
+      }
+
+      auto task = std::move(_tasks.front()); _tasks.pop();
+      ++_running_size;
+
+      lock.unlock();
+
+      _executor.submit(
+        [this, task = std::move(task)]() {
+          task();
+
+          std::unique_lock<std::mutex> lock(_mutex);
+          --_running_size;
+          _condition_variable.notify_all();  // デストラクタが先に進まないように、ロックを持ったまま通知します。
+
+          dispatch(lock);
+        });
+    }
+
+  public:
+    thread_pool_share(Executor& executor, const int& size) noexcept
+      : _executor(executor), _size(std::max(size, 1)), _running_size(0), _tasks(), _mutex(), _condition_variable()
+    {
+      ;
+    }
+
+    // 実行中の処理が、このオブジェクトを参照しなくなるまで待ちます。
+    ~thread_pool_share() {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _condition_variable.wait(lock, [&]() { return _running_size == 0 && _tasks.empty(); });
+    }
+
+    template <typename F>
+    auto submit(F&& f) noexcept {
+      const auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+      auto result = task->get_future();
+
+      std::unique_lock<std::mutex> lock(_mutex);
+      _tasks.emplace([task]() { (*task)(); });
+
+      dispatch(lock);
+
+      return result;
+    }
+  };
+}
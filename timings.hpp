@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "trace.hpp"
+
+namespace hexagonal_walk {
+  // 処理にかかった時間（ミリ秒）を、名前ごとに記録します。並列に実行された同じ名前の処理は、一番遅かったものを記録します。
+  // traceを渡した場合は、measure()の期間をトレースにも記録します。
+  class timings {
+    std::mutex _mutex;
+    std::map<std::string, double> _milliseconds;
+    hexagonal_walk::trace* _trace;
+
+    class stopwatch {
+      timings* _timings;
+      const char* _name;
+      const std::chrono::steady_clock::time_point _starting_time;
+
+    public:
+      stopwatch(timings* timings, const char* name) noexcept
+        : _timings(timings), _name(name), _starting_time(std::chrono::steady_clock::now())
+      {
+        ;
+      }
+
+      stopwatch(stopwatch&& other) noexcept
+        : _timings(other._timings), _name(other._name), _starting_time(other._starting_time)
+      {
+        other._timings = nullptr;
+      }
+
+      ~stopwatch() {
+        if (!_timings) {
+          return;
+        }
+
+        const auto finishing_time = std::chrono::steady_clock::now();
+
+        _timings->record(_name, std::chrono::duration<double, std::milli>(finishing_time - _starting_time).count());
+
+        if (_timings->_trace) {
+          _timings->_trace->span(_name, _starting_time, finishing_time);
+        }
+      }
+    };
+
+  public:
+    explicit timings(hexagonal_walk::trace* trace = nullptr) noexcept
+      : _mutex(), _milliseconds(), _trace(trace)
+    {
+      ;
+    }
+
+    // 戻り値のstopwatchが破棄されるまでの時間を記録します。
+    auto measure(const char* name) noexcept {
+      return stopwatch(this, name);
+    }
+
+    void record(const std::string& name, const double& milliseconds) noexcept {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      auto& value = _milliseconds[name];
+      value = std::max(value, milliseconds);
+    }
+
+    const auto& milliseconds() const noexcept {
+      return _milliseconds;
+    }
+
+    const auto trace() const noexcept {
+      return _trace;
+    }
+  };
+}
@@ -0,0 +1,106 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace hexagonal_walk {
+  // JSONの文字列リテラルにします。ファイル名くらいしか入らないので、"と\だけをエスケープします。
+  inline auto json_string(const std::string& string) noexcept {
+    std::string result("\"");
+
+    for (const auto& c : string) {
+      if (c == '"' || c == '\\') {
+        result += '\\';
+      }
+
+      result += c;
+    }
+
+    return result + "\"";
+  }
+
+  // スレッドがいつ何をしていたかを、Chrome（chrome://tracing）やPerfettoで読めるトレース・イベントの形式で記録します。
+  // 記録するのは探索の開始と終了、解の改善くらいで数が少ないので、ミューテックスで守ったvectorに溜めておいて、最後にまとめて書き出します。
+  class trace {
+    class event {
+      std::string _name;
+      char _phase;              // 'X'は期間、'i'は瞬間です。
+      std::int64_t _timestamp;  // 記録を始めてからのマイクロ秒です。
+      std::int64_t _duration;
+      int _thread;
+      std::string _arguments;   // JSONのオブジェクトの中身です。
+
+    public:
+      event(const std::string& name, const char& phase, const std::int64_t& timestamp, const std::int64_t& duration, const int& thread, const std::string& arguments) noexcept
+        : _name(name), _phase(phase), _timestamp(timestamp), _duration(duration), _thread(thread), _arguments(arguments)
+      {
+        ;
+      }
+
+      void write(std::ostream& stream) const noexcept {
+        stream << "{\"name\": " << json_string(_name) << ", \"ph\": \"" << _phase << "\", \"ts\": " << _timestamp;
+
+        if (_phase == 'X') {
+          stream << ", \"dur\": " << _duration;
+        } else {
+          stream << ", \"s\": \"t\"";
+        }
+
+        stream << ", \"pid\": 1, \"tid\": " << _thread << ", \"args\": {" << _arguments << "}}";
+      }
+    };
+
+    std::mutex _mutex;
+    std::chrono::steady_clock::time_point _starting_time;
+    std::vector<event> _events;
+    std::unordered_map<std::thread::id, int> _threads;  // スレッドに、見やすい小さな番号を振ります。
+
+    const auto timestamp(const std::chrono::steady_clock::time_point& time_point) const noexcept {
+      return static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(time_point - _starting_time).count());
+    }
+
+    const auto thread() noexcept {
+      return _threads.emplace(std::this_thread::get_id(), static_cast<int>(_threads.size())).first->second;
+    }
+
+  public:
+    explicit trace(const std::chrono::steady_clock::time_point& starting_time) noexcept
+      : _mutex(), _starting_time(starting_time), _events(), _threads()
+    {
+      ;
+    }
+
+    // 呼び出したスレッドで、starting_timeからfinishing_timeまでnameを実行していたことを記録します。
+    void span(const std::string& name, const std::chrono::steady_clock::time_point& starting_time, const std::chrono::steady_clock::time_point& finishing_time, const std::string& arguments = "") noexcept {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _events.emplace_back(name, 'X', timestamp(starting_time), timestamp(finishing_time) - timestamp(starting_time), thread(), arguments);
+    }
+
+    // 呼び出したスレッドで、今nameが起きたことを記録します。
+    void instant(const std::string& name, const std::string& arguments = "") noexcept {
+      const auto now = std::chrono::steady_clock::now();
+
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _events.emplace_back(name, 'i', timestamp(now), 0, thread(), arguments);
+    }
+
+    void write(std::ostream& stream) noexcept {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      stream << "{\"traceEvents\": [\n";
+      for (auto i = 0; i < static_cast<int>(_events.size()); ++i) {
+        _events[i].write(stream);
+        stream << (i + 1 < static_cast<int>(_events.size()) ? ",\n" : "\n");
+      }
+      stream << "]}" << std::endl;
+    }
+  };
+}
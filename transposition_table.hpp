@@ -0,0 +1,108 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace hexagonal_walk {
+  // 探索済みの状態のハッシュ値を記録する、固定容量で開番地法のハッシュ表です。ロックなしで、複数のスレッドから同時に使用できます。
+  // 値は、下位8ビットを世代に使用します。ハッシュ値の残りの56ビットが一致したら、同じ状態とみなします。
+  class transposition_table {
+  public:
+    enum class replacement_policy {
+      none,    // 空きが見つからなければ、記録しません。
+      older    // 前の世代の値を、上書きします。
+    };
+
+  private:
+    static constexpr int max_probe_size = 8;  // 表が混んできたら、長く探すより諦めた方が速いです。
+
+    std::unique_ptr<std::atomic<std::uint64_t>[]> _entries;
+    std::size_t _mask;
+    replacement_policy _replacement_policy;
+    std::atomic<std::uint64_t> _generation;
+
+    std::atomic<std::uint64_t> _hit_count;
+    std::atomic<std::uint64_t> _collision_count;
+    std::atomic<std::uint64_t> _drop_count;
+
+  public:
+    transposition_table(const std::size_t& capacity, const replacement_policy& replacement_policy = replacement_policy::none) noexcept
+      : _entries(), _mask(0), _replacement_policy(replacement_policy), _generation(1), _hit_count(0), _collision_count(0), _drop_count(0)
+    {
+      auto size = static_cast<std::size_t>(1);
+      while (size < capacity) {
+        size <<= 1;
+      }
+
+      _entries.reset(new std::atomic<std::uint64_t>[size]);
+      for (auto i = static_cast<std::size_t>(0); i < size; ++i) {
+        _entries[i].store(0, std::memory_order_relaxed);  // 世代は1から始まるので、0は空きです。
+      }
+
+      _mask = size - 1;
+    }
+
+    // hashを記録します。既に記録されていた場合はfalseを、そうでなければ（記録できなかった場合も）trueを返します。
+    const auto insert(const std::uint64_t& hash) noexcept {
+      const auto generation = _generation.load(std::memory_order_relaxed);
+      const auto key = hash & ~static_cast<std::uint64_t>(0xff);
+      const auto entry = key | generation;
+
+      const auto home = static_cast<std::size_t>((hash * 0x9e3779b97f4a7c15ull) >> 32);  // 下位ビットは世代で潰れているので、掛け算で上位ビットを混ぜます。
+
+      for (auto i = 0; i < max_probe_size; ++i) {
+        auto& slot = _entries[(home + i) & _mask];
+        auto current = slot.load(std::memory_order_relaxed);
+
+        while (true) {
+          if (current == 0 || (_replacement_policy == replacement_policy::older && (current & 0xff) != generation)) {
+            if (slot.compare_exchange_weak(current, entry, std::memory_order_relaxed)) {
+              return true;
+            }
+
+            continue;  // 他のスレッドが書き込んだので、同じ場所を見直します。
+          }
+
+          if ((current & ~static_cast<std::uint64_t>(0xff)) == key) {
+            _hit_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+          }
+
+          break;
+        }
+
+        _collision_count.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      _drop_count.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // 世代を進めます。replacement_policy::olderなら、これまでの値は上書きされるようになります。
+    void next_generation() noexcept {
+      auto generation = _generation.load(std::memory_order_relaxed) + 1;
+      if (generation > 0xff) {
+        generation = 1;  // 一周すると古い値が残っていることがありますが、56ビットが一致する確率は無視できます。
+      }
+
+      _generation.store(generation, std::memory_order_relaxed);
+    }
+
+    const auto capacity() const noexcept {
+      return _mask + 1;
+    }
+
+    const auto hit_count() const noexcept {
+      return _hit_count.load(std::memory_order_relaxed);
+    }
+
+    const auto collision_count() const noexcept {
+      return _collision_count.load(std::memory_order_relaxed);
+    }
+
+    const auto drop_count() const noexcept {
+      return _drop_count.load(std::memory_order_relaxed);
+    }
+  };
+}